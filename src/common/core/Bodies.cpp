@@ -3,16 +3,21 @@
 #include <mipp.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <limits>
+#include <numeric>
 #include <string>
 
+#include "../utils/BoundingBox.hpp"
 #include "../utils/Perf.hpp"
 
+#define PARALLEL_UPDATE_MIN_BODIES 4096 // fewer bodies are integrated faster than the threads are woken up
+
 template <typename T>
 Bodies<T>::Bodies(const unsigned long n, const std::string &scheme, const unsigned long randInit)
-    : n(n), padding(0), allocatedBytes(0)
+    : n(n), padding(0), allocatedBytes(0), reorderPeriod(0), nUpdates(0), nReorders(0)
 {
     assert(n > 0);
     if (scheme == "galaxy")
@@ -31,18 +36,23 @@ Bodies<T>::Bodies(const unsigned long n, const std::string &scheme, const unsign
 
 template <typename T> void Bodies<T>::allocateBuffers()
 {
-    this->dataSoA.m.resize(this->n + this->padding);
-    this->dataSoA.r.resize(this->n + this->padding);
-    this->dataSoA.qx.resize(this->n + this->padding);
-    this->dataSoA.qy.resize(this->n + this->padding);
-    this->dataSoA.qz.resize(this->n + this->padding);
-    this->dataSoA.vx.resize(this->n + this->padding);
-    this->dataSoA.vy.resize(this->n + this->padding);
-    this->dataSoA.vz.resize(this->n + this->padding);
+    // the threads that integrate a body place its data on their NUMA node
+    firstTouch(this->dataSoA.m, this->n + this->padding);
+    firstTouch(this->dataSoA.r, this->n + this->padding);
+    firstTouch(this->dataSoA.qx, this->n + this->padding);
+    firstTouch(this->dataSoA.qy, this->n + this->padding);
+    firstTouch(this->dataSoA.qz, this->n + this->padding);
+    firstTouch(this->dataSoA.vx, this->n + this->padding);
+    firstTouch(this->dataSoA.vy, this->n + this->padding);
+    firstTouch(this->dataSoA.vz, this->n + this->padding);
 
     this->dataAoS.resize(this->n + this->padding);
 
-    this->allocatedBytes = (this->n + this->padding) * sizeof(T) * 8 * 2;
+    this->ids.resize(this->n);
+    std::iota(this->ids.begin(), this->ids.end(), 0);
+    this->permutation = this->ids;
+
+    this->allocatedBytes = (this->n + this->padding) * sizeof(T) * 8 * 2 + this->n * sizeof(unsigned long) * 2;
 }
 
 template <typename T> const unsigned long Bodies<T>::getN() const { return this->n; }
@@ -55,6 +65,29 @@ template <typename T> const std::vector<dataAoS_t<T>> &Bodies<T>::getDataAoS() c
 
 template <typename T> const float Bodies<T>::getAllocatedBytes() const { return this->allocatedBytes; }
 
+template <typename T> const std::vector<unsigned long> &Bodies<T>::getIds() const { return this->ids; }
+
+template <typename T> const std::vector<unsigned long> &Bodies<T>::getPermutation() const
+{
+    return this->permutation;
+}
+
+template <typename T> unsigned long Bodies<T>::getReorderCount() const { return this->nReorders; }
+
+template <typename T> void Bodies<T>::setReorderPeriod(const unsigned period)
+{
+    this->reorderPeriod = period;
+    if (period && this->curveKeys.empty()) {
+        this->curveKeys.resize(this->n);
+        this->allocatedBytes += this->n * sizeof(std::pair<uint64_t, unsigned long>);
+    }
+}
+
+template <typename T> void Bodies<T>::getBoundingBox(T min[3], T max[3]) const
+{
+    computeBoundingBox(this->dataSoA.qx.data(), this->dataSoA.qy.data(), this->dataSoA.qz.data(), this->n, min, max);
+}
+
 template <typename T>
 void Bodies<T>::setBody(const unsigned long &iBody, const T &mi, const T &ri, const T &qix, const T &qiy, const T &qiz,
                         const T &vix, const T &viy, const T &viz)
@@ -401,22 +434,90 @@ void Bodies<T>::updatePositionAndVelocity(const unsigned long iBody, const T mi,
 
 template <typename T> void Bodies<T>::updatePositionsAndVelocities(const accSoA_t<T> &accelerations, T &dt)
 {
-    // flops = n * 18
-    for (unsigned long iBody = 0; iBody < this->n; iBody++)
+    // flops = n * 18, with the static partition of `firstTouch`
+    const long n = this->n;
+#pragma omp parallel for schedule(static) if (n >= PARALLEL_UPDATE_MIN_BODIES)
+    for (long iBody = 0; iBody < n; iBody++)
         updatePositionAndVelocity(iBody, this->dataSoA.m[iBody], this->dataSoA.r[iBody], this->dataSoA.qx[iBody],
                                   this->dataSoA.qy[iBody], this->dataSoA.qz[iBody], this->dataSoA.vx[iBody],
                                   this->dataSoA.vy[iBody], this->dataSoA.vz[iBody], accelerations.ax[iBody],
                                   accelerations.ay[iBody], accelerations.az[iBody], dt);
+
+    if (this->reorderPeriod && ++this->nUpdates % this->reorderPeriod == 0)
+        this->reorder();
 }
 
 template <typename T> void Bodies<T>::updatePositionsAndVelocities(const std::vector<accAoS_t<T>> &accelerations, T &dt)
 {
-    // flops = n * 18
-    for (unsigned long iBody = 0; iBody < this->n; iBody++)
+    // flops = n * 18, with the static partition of `firstTouch`
+    const long n = this->n;
+#pragma omp parallel for schedule(static) if (n >= PARALLEL_UPDATE_MIN_BODIES)
+    for (long iBody = 0; iBody < n; iBody++)
         updatePositionAndVelocity(iBody, this->dataSoA.m[iBody], this->dataSoA.r[iBody], this->dataSoA.qx[iBody],
                                   this->dataSoA.qy[iBody], this->dataSoA.qz[iBody], this->dataSoA.vx[iBody],
                                   this->dataSoA.vy[iBody], this->dataSoA.vz[iBody], accelerations[iBody].ax,
                                   accelerations[iBody].ay, accelerations[iBody].az, dt);
+
+    if (this->reorderPeriod && ++this->nUpdates % this->reorderPeriod == 0)
+        this->reorder();
+}
+
+// spreads the 21 lower bits of `v` to every third bit
+static inline uint64_t expandBits(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8) & 0x100f00f00f00f00full;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2) & 0x1249249249249249ull;
+    return v;
+}
+
+// gathers `data[perm[i]]` into `data[i]` for the first `perm.size()` elements, `tmp` is a scratch buffer
+template <typename V> static void applyPermutation(V *data, std::vector<V> &tmp, const std::vector<unsigned long> &perm)
+{
+    const long n = perm.size();
+    tmp.assign(data, data + n);
+#pragma omp parallel for
+    for (long i = 0; i < n; i++)
+        data[i] = tmp[perm[i]];
+}
+
+template <typename T> void Bodies<T>::reorder()
+{
+    if (this->curveKeys.size() != this->n)
+        this->curveKeys.resize(this->n);
+
+    T min[3], max[3];
+    this->getBoundingBox(min, max);
+    const T size = std::max(std::max(max[0] - min[0], max[1] - min[1]), max[2] - min[2]);
+    const T scale = size > 0 ? (T)0x1fffff / size : (T)0;
+
+    const long n = this->n;
+#pragma omp parallel for
+    for (long i = 0; i < n; i++) {
+        const uint64_t x = (uint64_t)((this->dataSoA.qx[i] - min[0]) * scale);
+        const uint64_t y = (uint64_t)((this->dataSoA.qy[i] - min[1]) * scale);
+        const uint64_t z = (uint64_t)((this->dataSoA.qz[i] - min[2]) * scale);
+        this->curveKeys[i] = std::make_pair(expandBits(x) | expandBits(y) << 1 | expandBits(z) << 2, (unsigned long)i);
+    }
+    std::sort(this->curveKeys.begin(), this->curveKeys.end());
+    for (long i = 0; i < n; i++)
+        this->permutation[i] = this->curveKeys[i].second;
+
+    // the padding bodies stay at the end
+    std::vector<T> tmp;
+    soaArray_t<T> *arrays[8] = {&this->dataSoA.qx, &this->dataSoA.qy, &this->dataSoA.qz, &this->dataSoA.vx,
+                                 &this->dataSoA.vy, &this->dataSoA.vz, &this->dataSoA.m,  &this->dataSoA.r};
+    for (soaArray_t<T> *array : arrays)
+        applyPermutation(array->data(), tmp, this->permutation);
+    std::vector<dataAoS_t<T>> tmpAoS;
+    applyPermutation(this->dataAoS.data(), tmpAoS, this->permutation);
+    std::vector<unsigned long> tmpIds;
+    applyPermutation(this->ids.data(), tmpIds, this->permutation);
+
+    this->nReorders++;
 }
 
 // ==================================================================================== explicit template instantiation
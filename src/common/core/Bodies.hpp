@@ -1,9 +1,19 @@
 #ifndef BODIES_HPP_
 #define BODIES_HPP_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
+#include "../utils/FirstTouch.hpp"
+
+/*!
+ * \brief  Array of a structure of arrays, left uninitialized by `resize` so that `firstTouch` places its pages.
+ *
+ * \tparam T : Type.
+ */
+template <typename T> using soaArray_t = std::vector<T, FirstTouchAllocator<T>>;
+
 /*!
  * \struct dataSoA_t
  * \brief  Structure of arrays.
@@ -13,14 +23,14 @@
  * The dataSoA_t structure represent the characteristics of the bodies.
  */
 template <typename T> struct dataSoA_t {
-    std::vector<T> qx; /*!< Array of positions x. */
-    std::vector<T> qy; /*!< Array of positions y. */
-    std::vector<T> qz; /*!< Array of positions z. */
-    std::vector<T> vx; /*!< Array of velocities x. */
-    std::vector<T> vy; /*!< Array of velocities y. */
-    std::vector<T> vz; /*!< Array of velocities z. */
-    std::vector<T> m;  /*!< Array of masses. */
-    std::vector<T> r;  /*!< Array of radiuses. */
+    soaArray_t<T> qx; /*!< Array of positions x. */
+    soaArray_t<T> qy; /*!< Array of positions y. */
+    soaArray_t<T> qz; /*!< Array of positions z. */
+    soaArray_t<T> vx; /*!< Array of velocities x. */
+    soaArray_t<T> vy; /*!< Array of velocities y. */
+    soaArray_t<T> vz; /*!< Array of velocities z. */
+    soaArray_t<T> m;  /*!< Array of masses. */
+    soaArray_t<T> r;  /*!< Array of radiuses. */
 };
 
 /*!
@@ -51,9 +61,9 @@ template <typename T> struct dataAoS_t {
  * The accSoA_t structure represent the accelerations of the bodies.
  */
 template <typename T> struct accSoA_t {
-    std::vector<T> ax; /*!< Array of accelerations x. */
-    std::vector<T> ay; /*!< Array of accelerations y. */
-    std::vector<T> az; /*!< Array of accelerations z. */
+    soaArray_t<T> ax; /*!< Array of accelerations x. */
+    soaArray_t<T> ay; /*!< Array of accelerations y. */
+    soaArray_t<T> az; /*!< Array of accelerations z. */
 };
 
 /*!
@@ -83,6 +93,12 @@ template <typename T> class Bodies {
     std::vector<dataAoS_t<T>> dataAoS; /*!< Array of structures of bodies data. */
     unsigned short padding;            /*!< Number of fictional bodies to fill the last vector. */
     float allocatedBytes;              /*!< Number of allocated bytes. */
+    std::vector<unsigned long> ids;    /*!< Stable identifier (initial index) of the body stored at each index. */
+    std::vector<unsigned long> permutation; /*!< Index before the last reordering of the body stored at each index. */
+    std::vector<std::pair<uint64_t, unsigned long>> curveKeys; /*!< Morton keys of the bodies, sorted to reorder. */
+    unsigned reorderPeriod;            /*!< Number of updates between two reorderings (0 to never reorder). */
+    unsigned long nUpdates;            /*!< Number of updates of the positions and velocities. */
+    unsigned long nReorders;           /*!< Number of reorderings of the bodies. */
 
   public:
     /*!
@@ -138,6 +154,52 @@ template <typename T> class Bodies {
      */
     const float getAllocatedBytes() const;
 
+    /*!
+     *  \brief Bounding box of the bodies (the padding bodies excluded).
+     *
+     *  \param min : Lower corner of the box (x, y, z).
+     *  \param max : Upper corner of the box (x, y, z).
+     *
+     *  Vectorized and multi-threaded reduction over the SoA positions, see `computeBoundingBox`.
+     */
+    void getBoundingBox(T min[3], T max[3]) const;
+
+    /*!
+     *  \brief Identifiers getter.
+     *
+     *  \return The stable identifier of the body stored at each index: its index at initialization.
+     */
+    const std::vector<unsigned long> &getIds() const;
+
+    /*!
+     *  \brief Permutation getter.
+     *
+     *  \return The index before the last reordering of the body stored at each index (identity if never reordered).
+     */
+    const std::vector<unsigned long> &getPermutation() const;
+
+    /*!
+     *  \brief Reorderings counter getter.
+     *
+     *  \return The number of reorderings so far, lets the implementations drop the data indexed by the old order.
+     */
+    unsigned long getReorderCount() const;
+
+    /*!
+     *  \brief Reordering period setter.
+     *
+     *  \param period : Number of updates of the positions between two reorderings (0 to never reorder).
+     */
+    void setReorderPeriod(const unsigned period);
+
+    /*!
+     *  \brief Sort the bodies along a Morton curve.
+     *
+     *  Bodies close in space get close in memory, for all the arrays of the SoA and the AoS. The ids and the
+     *  permutation keep track of the moves.
+     */
+    void reorder();
+
     /*!
      *  \brief Update positions and velocities array.
      *
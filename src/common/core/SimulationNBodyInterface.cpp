@@ -9,20 +9,34 @@
 
 #include "SimulationNBodyInterface.hpp"
 
-SimulationNBodyInterface::SimulationNBodyInterface(const unsigned long nBodies, const std::string &scheme,
-                                                   const float soft, const unsigned long randInit)
-    : bodies(nBodies, scheme, randInit), dt(std::numeric_limits<float>::infinity()), soft(soft), flopsPerIte(0),
+template <typename T>
+SimulationNBodyInterface<T>::SimulationNBodyInterface(const unsigned long nBodies, const std::string &scheme,
+                                                      const T soft, const unsigned long randInit)
+    : bodies(nBodies, scheme, randInit), dt(std::numeric_limits<T>::infinity()), soft(soft), flopsPerIte(0),
       allocatedBytes(bodies.getAllocatedBytes())
 {
-    this->allocatedBytes += (this->bodies.getN() + this->bodies.getPadding()) * sizeof(float) * 3;
+    this->allocatedBytes += (this->bodies.getN() + this->bodies.getPadding()) * sizeof(T) * 3;
 }
 
-const Bodies<float> &SimulationNBodyInterface::getBodies() const { return this->bodies; }
+template <typename T> const Bodies<T> &SimulationNBodyInterface<T>::getBodies() const { return this->bodies; }
 
-void SimulationNBodyInterface::setDt(float dtVal) { this->dt = dtVal; }
+template <typename T> void SimulationNBodyInterface<T>::setDt(T dtVal) { this->dt = dtVal; }
 
-const float SimulationNBodyInterface::getDt() const { return this->dt; }
+template <typename T> void SimulationNBodyInterface<T>::setReorderPeriod(const unsigned period)
+{
+    this->bodies.setReorderPeriod(period);
+}
+
+template <typename T> const T SimulationNBodyInterface<T>::getDt() const { return this->dt; }
 
-const float SimulationNBodyInterface::getFlopsPerIte() const { return this->flopsPerIte; }
+template <typename T> const float SimulationNBodyInterface<T>::getFlopsPerIte() const { return this->flopsPerIte; }
+
+template <typename T> const float SimulationNBodyInterface<T>::getAllocatedBytes() const
+{
+    return this->allocatedBytes;
+}
 
-const float SimulationNBodyInterface::getAllocatedBytes() const { return this->allocatedBytes; }
+// ==================================================================================== explicit template instantiation
+template class SimulationNBodyInterface<double>;
+template class SimulationNBodyInterface<float>;
+// ==================================================================================== explicit template instantiation
@@ -8,15 +8,17 @@
 /*!
  * \class  SimulationNBodyInterface
  * \brief  This is the main simulation class, it describes the main methods to implement in extended classes.
+ *
+ * \tparam T : Type of the positions, velocities and accelerations (float or double).
  */
-class SimulationNBodyInterface {
+template <typename T> class SimulationNBodyInterface {
   protected:
-    const float G = 6.67384e-11f; /*!< The gravitational constant in m^3.kg^-1.s^-2. */
-    Bodies<float> bodies;         /*!< Bodies object, represent all the bodies available in space. */
-    float dt;                     /*!< Time step value. */
-    float soft;                   /*!< Softening factor value. */
-    float flopsPerIte;            /*!< Number of floating-point operations per iteration. */
-    float allocatedBytes;         /*!< Number of allocated bytes. */
+    const T G = (T)6.67384e-11; /*!< The gravitational constant in m^3.kg^-1.s^-2. */
+    Bodies<T> bodies;           /*!< Bodies object, represent all the bodies available in space. */
+    T dt;                       /*!< Time step value. */
+    T soft;                     /*!< Softening factor value. */
+    float flopsPerIte;          /*!< Number of floating-point operations per iteration. */
+    float allocatedBytes;       /*!< Number of allocated bytes. */
 
   protected:
     /*!
@@ -30,7 +32,7 @@ class SimulationNBodyInterface {
      *  \param randInit  : PNRG seed.
      */
     SimulationNBodyInterface(const unsigned long nBodies, const std::string &scheme = "galaxy",
-                             const float soft = 0.035f, const unsigned long randInit = 0);
+                             const T soft = 0.035f, const unsigned long randInit = 0);
 
   public:
     /*!
@@ -52,21 +54,29 @@ class SimulationNBodyInterface {
      *
      *  \return Bodies class.
      */
-    const Bodies<float> &getBodies() const;
+    const Bodies<T> &getBodies() const;
 
     /*!
      *  \brief dt setter.
      *
      *  \param dtVal : Constant time step value.
      */
-    void setDt(float dtVal);
+    void setDt(T dtVal);
+
+    /*!
+     *  \brief Reordering period setter.
+     *
+     *  \param period : Number of iterations between two reorderings of the bodies along a space-filling curve (0 to
+     *                  keep their initial order).
+     */
+    void setReorderPeriod(const unsigned period);
 
     /*!
      *  \brief Time step getter.
      *
      *  \return Time step value.
      */
-    const float getDt() const;
+    const T getDt() const;
 
     /*!
      *  \brief Flops per iteration getter.
@@ -3,6 +3,8 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
+#include <algorithm>
+#include <cmath>
 #include <thread>
 
 OGLControl::OGLControl(GLFWwindow *window)
@@ -108,6 +110,23 @@ glm::mat4 OGLControl::computeViewAndProjectionMatricesFromInputs()
     return this->projectionMatrix * this->viewMatrix;
 }
 
+void OGLControl::fitBoundingBox(const glm::vec3 &min, const glm::vec3 &max)
+{
+    int winWidth, winHeight;
+    glfwGetWindowSize(this->window, &winWidth, &winHeight);
+    const float aspect = (winWidth * 1.0f) / (winHeight * 1.0f);
+
+    // the bounding sphere of the box has to fit in the narrowest of the two fields of view
+    const glm::vec3 center = 0.5f * (min + max);
+    const float radius = std::max(0.5f * glm::length(max - min), 1e-3f);
+    const float tanHalfFoV = std::abs(std::tan(0.5f * this->initialFoV)) * std::min(aspect, 1.0f);
+    const float distance = radius * std::sqrt(1.0f + 1.0f / (tanHalfFoV * tanHalfFoV));
+
+    this->camPosition = center - distance * this->direction;
+    this->speed = std::max(3.0f, radius);
+    this->projectionMatrix = glm::perspective(this->initialFoV, aspect, 0.1f, std::max(5000.0f, 2.0f * distance));
+}
+
 glm::mat4 OGLControl::getViewMatrix() { return this->viewMatrix; }
 
 glm::mat4 OGLControl::getProjectionMatrix() { return this->projectionMatrix; }
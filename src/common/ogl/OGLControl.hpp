@@ -42,6 +42,9 @@ class OGLControl {
 
     glm::mat4 computeViewAndProjectionMatricesFromInputs();
 
+    // moves the camera back along its direction until the box fits in the field of view
+    void fitBoundingBox(const glm::vec3 &min, const glm::vec3 &max);
+
     glm::mat4 getViewMatrix();
 
     glm::mat4 getProjectionMatrix();
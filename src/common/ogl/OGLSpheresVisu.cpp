@@ -11,6 +11,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 
+#include "../utils/BoundingBox.hpp"
 #include "OGLSpheresVisu.hpp"
 #include "OGLTools.hpp"
 
@@ -85,6 +86,7 @@ OGLSpheresVisu<T>::OGLSpheresVisu(const std::string winName, const int winWidth,
 
         // Create a control object in order to use mouse and keyboard (move in space)
         this->control = new OGLControl(this->window);
+        this->fitCamera();
 
         // Enable depth test
         glEnable(GL_DEPTH_TEST);
@@ -181,6 +183,16 @@ bool OGLSpheresVisu<T>::compileShaders(const std::vector<GLenum> shadersType,
     return isFine;
 }
 
+template <typename T> void OGLSpheresVisu<T>::fitCamera()
+{
+    T min[3], max[3];
+    computeBoundingBox(this->positionsX, this->positionsY, this->positionsZ, this->nSpheres, min, max);
+
+    // same scale as in the shaders
+    this->control->fitBoundingBox(1.0e-8f * glm::vec3(min[0], min[1], min[2]),
+                                  1.0e-8f * glm::vec3(max[0], max[1], max[2]));
+}
+
 template <typename T> void OGLSpheresVisu<T>::updatePositions()
 {
     // convert positions in float (if necessary)
@@ -67,6 +67,7 @@ template <typename T> class OGLSpheresVisu : public SpheresVisu {
   protected:
     bool compileShaders(const std::vector<GLenum> shadersType, const std::vector<std::string> shadersFiles);
     void updatePositions();
+    void fitCamera();
 };
 
 #endif /* OGL_SPHERES_VISU_HPP_ */
@@ -152,6 +152,10 @@ template <typename T> void OGLSpheresVisuGS<T>::refreshDisplay()
             );
         }
 
+        // Re-center the camera on the bodies
+        if (glfwGetKey(this->window, GLFW_KEY_F) == GLFW_PRESS)
+            this->fitCamera();
+
         // Compute the MVP matrix from keyboard and mouse input
         this->mvp = this->control->computeViewAndProjectionMatricesFromInputs();
 
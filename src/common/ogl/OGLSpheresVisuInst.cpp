@@ -135,6 +135,10 @@ template <typename T> void OGLSpheresVisuInst<T>::refreshDisplay()
             (void *)0       // array buffer offset
         );
 
+        // Re-center the camera on the bodies
+        if (glfwGetKey(this->window, GLFW_KEY_F) == GLFW_PRESS)
+            this->fitCamera();
+
         // Compute the MVP matrix from keyboard and mouse input
         this->mvp = this->control->computeViewAndProjectionMatricesFromInputs();
 
@@ -0,0 +1,69 @@
+#include "Affinity.hpp"
+
+#include <omp.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <tuple>
+#include <utility>
+
+static int getSocket(const int core)
+{
+    std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(core) + "/topology/physical_package_id");
+    int socket = 0;
+    if (!(file >> socket))
+        socket = 0;
+    return socket;
+}
+
+std::vector<int> getAffinityCores(const std::string &policy)
+{
+    std::vector<int> cores;
+    if (policy != "compact" && policy != "scatter")
+        return cores;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return cores;
+
+    // (rank of the core in its socket, socket, core)
+    std::vector<std::tuple<int, int, int>> ordered;
+    std::map<int, int> nCoresPerSocket;
+    for (int core = 0; core < CPU_SETSIZE; core++)
+        if (CPU_ISSET(core, &set)) {
+            const int socket = getSocket(core);
+            ordered.push_back(std::make_tuple(nCoresPerSocket[socket]++, socket, core));
+        }
+
+    if (policy == "compact")
+        std::sort(ordered.begin(), ordered.end(),
+                  [](const std::tuple<int, int, int> &a, const std::tuple<int, int, int> &b) {
+                      return std::make_pair(std::get<1>(a), std::get<0>(a)) <
+                             std::make_pair(std::get<1>(b), std::get<0>(b));
+                  });
+    else
+        std::sort(ordered.begin(), ordered.end());
+
+    for (const std::tuple<int, int, int> &o : ordered)
+        cores.push_back(std::get<2>(o));
+    return cores;
+}
+
+bool pinThread(pthread_t thread, const int core)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+void pinOpenMPThreads(const std::vector<int> &cores)
+{
+    if (cores.empty())
+        return;
+#pragma omp parallel
+    pinThread(pthread_self(), cores[omp_get_thread_num() % cores.size()]);
+}
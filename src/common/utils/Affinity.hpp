@@ -0,0 +1,39 @@
+#ifndef AFFINITY_HPP_
+#define AFFINITY_HPP_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+/*!
+ * \fn     std::vector<int> getAffinityCores(const std::string &policy)
+ * \brief  Cores available to the process, in the order the threads are pinned to them.
+ *
+ * With "compact" the threads fill the cores of a socket before the ones of the next socket, with "scatter" they
+ * alternate between the sockets so that a few threads already get the memory bandwidth of all of them. The socket of
+ * a core is read from /sys/devices/system/cpu/cpu<core>/topology/physical_package_id.
+ *
+ * \param  policy : "compact" or "scatter".
+ *
+ * \return The cores, empty if the policy is unknown.
+ */
+std::vector<int> getAffinityCores(const std::string &policy);
+
+/*!
+ * \fn     bool pinThread(pthread_t thread, const int core)
+ * \brief  Restrict a thread to a single core.
+ *
+ * \return True if the thread has been pinned.
+ */
+bool pinThread(pthread_t thread, const int core);
+
+/*!
+ * \fn     void pinOpenMPThreads(const std::vector<int> &cores)
+ * \brief  Pin the thread t of the OpenMP team to the core `cores[t % cores.size()]`.
+ *
+ * The OpenMP runtime keeps its threads from one parallel region to the next, they stay pinned as long as the number
+ * of threads is not changed. The pages placed by `firstTouch` then stay next to the threads that use them.
+ */
+void pinOpenMPThreads(const std::vector<int> &cores);
+
+#endif /* AFFINITY_HPP_ */
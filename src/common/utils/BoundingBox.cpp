@@ -0,0 +1,75 @@
+#include "BoundingBox.hpp"
+
+#include <mipp.h>
+#include <omp.h>
+
+#include <algorithm>
+#include <cassert>
+
+template <typename T>
+void computeBoundingBox(const T *qx, const T *qy, const T *qz, const unsigned long n, T min[3], T max[3])
+{
+    assert(n > 0);
+    constexpr int N = mipp::N<T>();
+
+    min[0] = max[0] = qx[0];
+    min[1] = max[1] = qy[0];
+    min[2] = max[2] = qz[0];
+
+#pragma omp parallel
+    {
+        const unsigned long nThreads = omp_get_num_threads();
+        const unsigned long iThread = omp_get_thread_num();
+        // contiguous chunks, a multiple of the register size except for the last one
+        const unsigned long chunk = ((n + nThreads - 1) / nThreads + N - 1) / N * N;
+        const unsigned long begin = std::min(n, iThread * chunk);
+        const unsigned long end = std::min(n, begin + chunk);
+
+        T lmin[3] = {qx[0], qy[0], qz[0]};
+        T lmax[3] = {qx[0], qy[0], qz[0]};
+        unsigned long i = begin;
+        if (begin + N <= end) {
+            mipp::Reg<T> rminx = mipp::loadu(&qx[i]), rmaxx = rminx;
+            mipp::Reg<T> rminy = mipp::loadu(&qy[i]), rmaxy = rminy;
+            mipp::Reg<T> rminz = mipp::loadu(&qz[i]), rmaxz = rminz;
+            for (i += N; i + N <= end; i += N) {
+                const mipp::Reg<T> rqx = mipp::loadu(&qx[i]);
+                const mipp::Reg<T> rqy = mipp::loadu(&qy[i]);
+                const mipp::Reg<T> rqz = mipp::loadu(&qz[i]);
+                rminx = mipp::min(rminx, rqx);
+                rmaxx = mipp::max(rmaxx, rqx);
+                rminy = mipp::min(rminy, rqy);
+                rmaxy = mipp::max(rmaxy, rqy);
+                rminz = mipp::min(rminz, rqz);
+                rmaxz = mipp::max(rmaxz, rqz);
+            }
+            lmin[0] = mipp::hmin(rminx);
+            lmax[0] = mipp::hmax(rmaxx);
+            lmin[1] = mipp::hmin(rminy);
+            lmax[1] = mipp::hmax(rmaxy);
+            lmin[2] = mipp::hmin(rminz);
+            lmax[2] = mipp::hmax(rmaxz);
+        }
+        for (; i < end; i++) {
+            lmin[0] = std::min(lmin[0], qx[i]);
+            lmax[0] = std::max(lmax[0], qx[i]);
+            lmin[1] = std::min(lmin[1], qy[i]);
+            lmax[1] = std::max(lmax[1], qy[i]);
+            lmin[2] = std::min(lmin[2], qz[i]);
+            lmax[2] = std::max(lmax[2], qz[i]);
+        }
+
+#pragma omp critical
+        for (int d = 0; d < 3; d++) {
+            min[d] = std::min(min[d], lmin[d]);
+            max[d] = std::max(max[d], lmax[d]);
+        }
+    }
+}
+
+// ==================================================================================== explicit template instantiation
+template void computeBoundingBox<double>(const double *, const double *, const double *, const unsigned long,
+                                         double[3], double[3]);
+template void computeBoundingBox<float>(const float *, const float *, const float *, const unsigned long, float[3],
+                                        float[3]);
+// ==================================================================================== explicit template instantiation
@@ -0,0 +1,19 @@
+#ifndef BOUNDING_BOX_HPP_
+#define BOUNDING_BOX_HPP_
+
+/*!
+ * \fn     void computeBoundingBox(...)
+ * \brief  Axis aligned bounding box of n points given as a structure of arrays.
+ *
+ * Each thread reduces its share of the arrays one MIPP register at a time and the per-thread boxes are combined at the
+ * end, the points past `n` (e.g. the padding bodies) are never read.
+ *
+ * \tparam T          : Float type.
+ * \param  qx, qy, qz : Coordinates of the points.
+ * \param  n          : Number of points (> 0).
+ * \param  min, max   : Lower and upper corners of the box (x, y, z).
+ */
+template <typename T>
+void computeBoundingBox(const T *qx, const T *qy, const T *qz, const unsigned long n, T min[3], T max[3]);
+
+#endif /* BOUNDING_BOX_HPP_ */
@@ -0,0 +1,59 @@
+#ifndef FIRST_TOUCH_HPP_
+#define FIRST_TOUCH_HPP_
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*!
+ * \class  FirstTouchAllocator
+ * \brief  Allocator that leaves the elements default initialized, i.e. uninitialized for the arithmetic types.
+ *
+ * The pages of a fresh allocation are only placed on a NUMA node when they are first written. A `std::vector` with
+ * the standard allocator zeroes its elements from the thread calling `resize`, which puts the whole array on the node
+ * of that thread. With this allocator `resize` does not write the memory, `firstTouch` then writes each element from
+ * the thread that owns it in the static OpenMP partition, the one of the loops over the bodies.
+ *
+ * \tparam T : Type of the elements.
+ */
+template <typename T, typename A = std::allocator<T>> class FirstTouchAllocator : public A {
+    typedef std::allocator_traits<A> traits_t;
+
+  public:
+    template <typename U> struct rebind {
+        using other = FirstTouchAllocator<U, typename traits_t::template rebind_alloc<U>>;
+    };
+
+    using A::A;
+
+    template <typename U> void construct(U *ptr) noexcept(std::is_nothrow_default_constructible<U>::value)
+    {
+        ::new (static_cast<void *>(ptr)) U;
+    }
+
+    template <typename U, typename... Args> void construct(U *ptr, Args &&...args)
+    {
+        traits_t::construct(static_cast<A &>(*this), ptr, std::forward<Args>(args)...);
+    }
+};
+
+/*!
+ * \fn     void firstTouch(std::vector<T, A> &v, const unsigned long n)
+ * \brief  Resize a vector and zero its elements with the static partition of the OpenMP threads.
+ *
+ * \param  v : The vector, empty so that its memory is fresh.
+ * \param  n : Its new size.
+ */
+template <typename T, typename A> void firstTouch(std::vector<T, A> &v, const unsigned long n)
+{
+    v.resize(n);
+    T *data = v.data();
+    const long size = n;
+#pragma omp parallel for schedule(static)
+    for (long i = 0; i < size; i++)
+        data[i] = T();
+}
+
+#endif /* FIRST_TOUCH_HPP_ */
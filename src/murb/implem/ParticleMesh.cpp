@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <omp.h>
+
+#include "ParticleMesh.hpp"
+
+ParticleMesh::ParticleMesh(const float G, const float soft, const unsigned gridSize)
+    : G(G), softSquared(soft * soft), splitCells(0), gridSize(0), paddedSize(0), origin{0, 0, 0}, cellSize(0),
+      greenValid(false)
+{
+    this->setGridSize(gridSize);
+}
+
+long ParticleMesh::setGridSize(const unsigned gridSize)
+{
+    // the FFTs are radix 2, and the bodies need some cells between the ghost cells
+    unsigned size = 8;
+    while (size < gridSize)
+        size *= 2;
+    if (size == this->gridSize)
+        return 0;
+
+    const long before = this->getAllocatedBytes();
+    this->gridSize = size;
+    this->paddedSize = 2 * size;
+    const unsigned long N = size, M = 2 * size;
+    this->mass.assign(N * N * N, 0.f);
+    this->potential.assign(M * M * M, 0.f);
+    this->green.assign(M * M * M, 0.f);
+    this->fieldX.assign(N * N * N, 0.f);
+    this->fieldY.assign(N * N * N, 0.f);
+    this->fieldZ.assign(N * N * N, 0.f);
+
+    const double pi = std::acos(-1.0);
+    this->twiddles.resize(M / 2);
+    for (unsigned k = 0; k < M / 2; k++)
+        this->twiddles[k] = std::complex<float>(std::polar(1.0, -2 * pi * k / M));
+    unsigned bits = 0;
+    while ((1u << bits) < M)
+        bits++;
+    this->bitReversal.resize(M);
+    for (unsigned i = 0; i < M; i++) {
+        unsigned r = 0;
+        for (unsigned b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        this->bitReversal[i] = r;
+    }
+
+    this->cellSize = 0;
+    this->greenValid = false;
+
+    return (long)this->getAllocatedBytes() - before;
+}
+
+void ParticleMesh::setSplitCells(const float splitCells)
+{
+    this->splitCells = std::max(splitCells, 0.f);
+    this->greenValid = false;
+}
+
+unsigned ParticleMesh::getGridSize() const { return this->gridSize; }
+
+float ParticleMesh::getCellSize() const { return this->cellSize; }
+
+float ParticleMesh::getSplitRadius() const { return this->splitCells * this->cellSize; }
+
+unsigned long ParticleMesh::getAllocatedBytes() const
+{
+    return (this->mass.size() + this->fieldX.size() + this->fieldY.size() + this->fieldZ.size()) * sizeof(float) +
+           (this->potential.size() + this->green.size() + this->twiddles.size()) * sizeof(std::complex<float>) +
+           this->bitReversal.size() * sizeof(unsigned);
+}
+
+void ParticleMesh::placeMesh(const Bodies<float> &bodies)
+{
+    // the bodies have to stay between the ghost cells: their CIC nodes go up to one cell further
+    float min[3], max[3];
+    bodies.getBoundingBox(min, max);
+    const float inner = this->gridSize - 2 * PM_GHOST_CELLS - 1;
+    if (this->cellSize > 0) {
+        bool inside = true;
+        for (int d = 0; d < 3; d++)
+            inside = inside && min[d] >= this->origin[d] + PM_GHOST_CELLS * this->cellSize &&
+                     max[d] <= this->origin[d] + (PM_GHOST_CELLS + inner) * this->cellSize;
+        if (inside)
+            return;
+    }
+
+    const float size = std::max(std::max(max[0] - min[0], max[1] - min[1]), std::max(max[2] - min[2], 1.f));
+    this->cellSize = size * (1 + PM_MARGIN) / inner;
+    for (int d = 0; d < 3; d++)
+        this->origin[d] = (min[d] + max[d]) / 2 - (PM_GHOST_CELLS + inner / 2) * this->cellSize;
+    this->greenValid = false;
+}
+
+void ParticleMesh::computeGreen()
+{
+    // potential of a unit mass at each offset of the padded mesh, the offsets past the middle are the negative ones
+    const long M = this->paddedSize, N = this->gridSize;
+    const double h = this->cellSize, rs = this->splitCells * this->cellSize;
+    const double pi = std::acos(-1.0);
+#pragma omp parallel for
+    for (long z = 0; z < M; z++)
+        for (long y = 0; y < M; y++)
+            for (long x = 0; x < M; x++) {
+                const double dx = (x <= N ? x : x - M) * h;
+                const double dy = (y <= N ? y : y - M) * h;
+                const double dz = (z <= N ? z : z - M) * h;
+                // distance softened like the direct kernels, the split is applied to it as well
+                const double r = std::sqrt(dx * dx + dy * dy + dz * dz + this->softSquared);
+                double phi;
+                if (rs > 0)
+                    phi = r > 0 ? -this->G * std::erf(r / (2 * rs)) / r : -this->G / (rs * std::sqrt(pi));
+                else
+                    phi = -this->G / r;
+                this->green[(z * M + y) * M + x] = (float)phi;
+            }
+    this->transform(this->green, false, M);
+    this->greenValid = true;
+}
+
+void ParticleMesh::assignMasses(const dataSoA_t<float> &d, const unsigned long n)
+{
+    const long N = this->gridSize;
+    std::fill(this->mass.begin(), this->mass.end(), 0.f);
+    const float invH = 1.f / this->cellSize;
+
+    // the bodies are not sorted by cell, concurrent updates of a node are made atomic
+#pragma omp parallel for
+    for (long i = 0; i < (long)n; i++) {
+        const float ux = (d.qx[i] - this->origin[0]) * invH;
+        const float uy = (d.qy[i] - this->origin[1]) * invH;
+        const float uz = (d.qz[i] - this->origin[2]) * invH;
+        const long ix = (long)ux, iy = (long)uy, iz = (long)uz;
+        const float fx = ux - ix, fy = uy - iy, fz = uz - iz;
+        const float wx[2] = {1 - fx, fx}, wy[2] = {1 - fy, fy}, wz[2] = {1 - fz, fz};
+        for (int c = 0; c < 8; c++) {
+            const float w = d.m[i] * wx[c & 1] * wy[(c >> 1) & 1] * wz[c >> 2];
+#pragma omp atomic
+            this->mass[((iz + (c >> 2)) * N + iy + ((c >> 1) & 1)) * N + ix + (c & 1)] += w;
+        }
+    }
+}
+
+void ParticleMesh::solvePoisson()
+{
+    // zero padded masses, their convolution with the Green's function is the potential on the first N + 1 nodes
+    const long M = this->paddedSize, N = this->gridSize;
+    const float scale = 1.f / ((float)M * M * M);
+#pragma omp parallel for
+    for (long z = 0; z < M; z++)
+        for (long y = 0; y < M; y++) {
+            std::complex<float> *line = &this->potential[(z * M + y) * M];
+            if (z < N && y < N) {
+                const float *m = &this->mass[(z * N + y) * N];
+                for (long x = 0; x < N; x++)
+                    line[x] = m[x];
+                std::fill(line + N, line + M, 0.f);
+            } else {
+                std::fill(line, line + M, 0.f);
+            }
+        }
+
+    this->transform(this->potential, false, N);
+    const long size = M * M * M;
+#pragma omp parallel for
+    for (long i = 0; i < size; i++) {
+        const std::complex<float> a = this->potential[i], b = this->green[i];
+        this->potential[i] = std::complex<float>((a.real() * b.real() - a.imag() * b.imag()) * scale,
+                                                 (a.real() * b.imag() + a.imag() * b.real()) * scale);
+    }
+    this->transform(this->potential, true, N + 1);
+}
+
+void ParticleMesh::computeField()
+{
+    // 4-point centered differences, only on the nodes the bodies can reach: the others would need the wrapped part
+    const long M = this->paddedSize, N = this->gridSize;
+    const long lo = PM_GHOST_CELLS, hi = N - PM_GHOST_CELLS;
+    const float c1 = 8.f / (12.f * this->cellSize), c2 = 1.f / (12.f * this->cellSize);
+    const std::complex<float> *phi = this->potential.data();
+#pragma omp parallel for
+    for (long z = lo; z <= hi; z++)
+        for (long y = lo; y <= hi; y++)
+            for (long x = lo; x <= hi; x++) {
+                const long i = (z * M + y) * M + x;
+                const long g = (z * N + y) * N + x;
+                this->fieldX[g] = -(c1 * (phi[i + 1].real() - phi[i - 1].real()) -
+                                    c2 * (phi[i + 2].real() - phi[i - 2].real()));
+                this->fieldY[g] = -(c1 * (phi[i + M].real() - phi[i - M].real()) -
+                                    c2 * (phi[i + 2 * M].real() - phi[i - 2 * M].real()));
+                this->fieldZ[g] = -(c1 * (phi[i + M * M].real() - phi[i - M * M].real()) -
+                                    c2 * (phi[i + 2 * M * M].real() - phi[i - 2 * M * M].real()));
+            }
+}
+
+void ParticleMesh::interpolateField(const dataSoA_t<float> &d, const unsigned long n,
+                                    std::vector<accAoS_t<float>> &accelerations)
+{
+    const long N = this->gridSize;
+    const float invH = 1.f / this->cellSize;
+#pragma omp parallel for
+    for (long i = 0; i < (long)n; i++) {
+        const float ux = (d.qx[i] - this->origin[0]) * invH;
+        const float uy = (d.qy[i] - this->origin[1]) * invH;
+        const float uz = (d.qz[i] - this->origin[2]) * invH;
+        const long ix = (long)ux, iy = (long)uy, iz = (long)uz;
+        const float fx = ux - ix, fy = uy - iy, fz = uz - iz;
+        const float wx[2] = {1 - fx, fx}, wy[2] = {1 - fy, fy}, wz[2] = {1 - fz, fz};
+        float ax = 0, ay = 0, az = 0;
+        for (int c = 0; c < 8; c++) {
+            const float w = wx[c & 1] * wy[(c >> 1) & 1] * wz[c >> 2];
+            const long g = ((iz + (c >> 2)) * N + iy + ((c >> 1) & 1)) * N + ix + (c & 1);
+            ax += w * this->fieldX[g];
+            ay += w * this->fieldY[g];
+            az += w * this->fieldZ[g];
+        }
+        accelerations[i].ax += ax;
+        accelerations[i].ay += ay;
+        accelerations[i].az += az;
+    }
+}
+
+void ParticleMesh::transformLine(std::complex<float> *line, const bool inverse) const
+{
+    // iterative radix-2 Cooley-Tukey, the inverse is not scaled. The products are written out, std::complex checks for
+    // infinities otherwise.
+    const unsigned M = this->paddedSize;
+    for (unsigned i = 0; i < M; i++)
+        if (i < this->bitReversal[i])
+            std::swap(line[i], line[this->bitReversal[i]]);
+    const float sign = inverse ? -1.f : 1.f;
+    for (unsigned len = 2; len <= M; len *= 2) {
+        const unsigned half = len / 2, step = M / len;
+        for (unsigned start = 0; start < M; start += len)
+            for (unsigned k = 0; k < half; k++) {
+                const float wr = this->twiddles[k * step].real(), wi = sign * this->twiddles[k * step].imag();
+                const std::complex<float> a = line[start + k], b = line[start + k + half];
+                const float tr = wr * b.real() - wi * b.imag(), ti = wr * b.imag() + wi * b.real();
+                line[start + k] = std::complex<float>(a.real() + tr, a.imag() + ti);
+                line[start + k + half] = std::complex<float>(a.real() - tr, a.imag() - ti);
+            }
+    }
+}
+
+void ParticleMesh::transform(std::vector<std::complex<float>> &data, const bool inverse, const unsigned extent)
+{
+    // 3D FFT of the padded mesh, one dimension at a time. Only the first `extent` planes of the input are non zero in a
+    // forward transform, and only the first `extent` planes of the output are needed from an inverse transform, so the
+    // lines out of them are skipped.
+    const long M = this->paddedSize, E = extent, B = PM_FFT_BLOCK;
+    std::complex<float> *p = data.data();
+#pragma omp parallel
+    {
+        std::vector<std::complex<float>> lines(B * M);
+        for (int pass = 0; pass < 3; pass++) {
+            const int axis = inverse ? 2 - pass : pass;
+            if (axis == 0) {
+                // the x lines are contiguous, of the (z, y) planes
+#pragma omp for collapse(2)
+                for (long z = 0; z < E; z++)
+                    for (long y = 0; y < E; y++)
+                        this->transformLine(&p[(z * M + y) * M], inverse);
+                continue;
+            }
+
+            // the y lines of the (z, x) planes and the z lines of the (y, x) planes are strided: B neighbours along x
+            // are gathered at once, so that each access reads a whole cache line
+            const long outer = axis == 1 ? E : M;
+            const long stride = axis == 1 ? M : M * M;
+#pragma omp for collapse(2)
+            for (long a = 0; a < outer; a++)
+                for (long x = 0; x < M; x += B) {
+                    const long base = (axis == 1 ? a * M * M : a * M) + x;
+                    for (long i = 0; i < M; i++)
+                        for (long j = 0; j < B; j++)
+                            lines[j * M + i] = p[base + i * stride + j];
+                    for (long j = 0; j < B; j++)
+                        this->transformLine(&lines[j * M], inverse);
+                    for (long i = 0; i < M; i++)
+                        for (long j = 0; j < B; j++)
+                            p[base + i * stride + j] = lines[j * M + i];
+                }
+        }
+    }
+}
+
+void ParticleMesh::computeAccelerations(const Bodies<float> &bodies, std::vector<accAoS_t<float>> &accelerations)
+{
+    const dataSoA_t<float> &d = bodies.getDataSoA();
+    const unsigned long n = bodies.getN();
+
+    this->placeMesh(bodies);
+    if (!this->greenValid)
+        this->computeGreen();
+    this->assignMasses(d, n);
+    this->solvePoisson();
+    this->computeField();
+    this->interpolateField(d, n, accelerations);
+}
@@ -0,0 +1,90 @@
+#ifndef PARTICLE_MESH_HPP_
+#define PARTICLE_MESH_HPP_
+
+#include <complex>
+#include <vector>
+
+#include "core/Bodies.hpp"
+
+#define PM_GRID_SIZE 64   // default number of mesh cells per dimension, a power of 2
+#define PM_MARGIN 0.1f    // extra size of the mesh around the bodies, so that it is only moved once a body leaves it
+#define PM_GHOST_CELLS 2  // cells kept free on each side of the bodies for the 4-point gradient stencil
+#define PM_FFT_BLOCK 8    // strided lines transformed together, a power of 2 of at most 16
+
+/*!
+ * \class  ParticleMesh
+ * \brief  Gravity of the bodies computed on a regular mesh with FFTs.
+ *
+ * The masses are spread on a cubic mesh of `gridSize`^3 cells with the cloud-in-cell (CIC) scheme. The potential is
+ * their convolution with the Green's function of the softened kernel, computed with FFTs on a mesh of twice the size
+ * in each dimension, zero padded so that the bodies do not see the periodic images of the others (Hockney and
+ * Eastwood). The accelerations are the 4-point finite differences of the potential, interpolated back to the bodies
+ * with the same CIC weights, so that a body does not pull itself.
+ *
+ * With a split radius r_s, only the long range part of the gravity is computed: the kernel becomes erf(r / 2r_s) / r
+ * and the short range part erfc(r / 2r_s) / r is left to another solver (TreePM). Here r is the softened distance
+ * sqrt(d^2 + e^2), so that the two parts still add up to the softened kernel. r_s is given in cells, so that it
+ * follows the mesh when it is moved.
+ *
+ * The mesh covers the bounding box of the bodies plus a margin, it is kept as long as the bodies stay inside so that
+ * the transform of the Green's function is not computed again at every iteration.
+ */
+class ParticleMesh {
+  protected:
+    const float G;                              /*!< Gravitational constant. */
+    float softSquared;                          /*!< Squared softening factor. */
+    float splitCells;                           /*!< Split radius of the long range part in cells (0 for the full
+                                                     gravity). */
+    unsigned gridSize;                          /*!< Number of cells of the mesh per dimension. */
+    unsigned paddedSize;                        /*!< Number of cells of the zero padded mesh per dimension. */
+    float origin[3];                            /*!< Position of the first cell of the mesh. */
+    float cellSize;                             /*!< Size of the cells (0 if the mesh has to be placed). */
+    bool greenValid;                            /*!< The transform of the Green's function matches the mesh. */
+
+    std::vector<float> mass;                    /*!< Mass assigned to each cell of the mesh. */
+    std::vector<std::complex<float>> potential; /*!< Padded mesh: the masses, their transform, then the potential. */
+    std::vector<std::complex<float>> green;     /*!< Transform of the Green's function on the padded mesh. */
+    std::vector<float> fieldX;                  /*!< Acceleration at each node of the mesh. */
+    std::vector<float> fieldY;
+    std::vector<float> fieldZ;
+    std::vector<std::complex<float>> twiddles;  /*!< exp(-2i.pi.k / paddedSize) for k < paddedSize / 2. */
+    std::vector<unsigned> bitReversal;          /*!< Bit reversed index of each element of a line. */
+
+  public:
+    ParticleMesh(const float G, const float soft, const unsigned gridSize = PM_GRID_SIZE);
+    virtual ~ParticleMesh() = default;
+
+    /*!
+     *  \brief Resize the mesh, rounded up to a power of 2 of at least 8 cells per dimension.
+     *
+     *  \param gridSize : Number of cells of the mesh per dimension.
+     *
+     *  \return Change of the number of allocated bytes, negative when the mesh shrinks.
+     */
+    long setGridSize(const unsigned gridSize);
+    void setSplitCells(const float splitCells);
+    unsigned getGridSize() const;
+    float getCellSize() const;
+    float getSplitRadius() const;
+    unsigned long getAllocatedBytes() const;
+
+    /*!
+     *  \brief Add the accelerations computed on the mesh to the accelerations of the bodies.
+     *
+     *  \param bodies        : The bodies.
+     *  \param accelerations : Acceleration of each body, updated in place.
+     */
+    void computeAccelerations(const Bodies<float> &bodies, std::vector<accAoS_t<float>> &accelerations);
+
+  protected:
+    void placeMesh(const Bodies<float> &bodies);
+    void computeGreen();
+    void assignMasses(const dataSoA_t<float> &d, const unsigned long n);
+    void solvePoisson();
+    void computeField();
+    void interpolateField(const dataSoA_t<float> &d, const unsigned long n, std::vector<accAoS_t<float>> &accelerations);
+    void transform(std::vector<std::complex<float>> &data, const bool inverse, const unsigned extent);
+    void transformLine(std::complex<float> *line, const bool inverse) const;
+};
+
+#endif /* PARTICLE_MESH_HPP_ */
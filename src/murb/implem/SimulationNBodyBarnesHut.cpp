@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
@@ -5,33 +6,157 @@
 #include <limits>
 #include <string>
 
+#include "mipp.h"
+
+#include "SimulationNBodySIMDKernel.hpp"
 #include "SimulationNBodyBarnesHut.hpp"
 
+// the Morton keys are radix sorted on 11-bit digits, 6 passes cover their 63 bits
+constexpr int RADIX_BITS = 11;
+constexpr int RADIX_PASSES = 6;
+constexpr unsigned RADIX_SIZE = 1 << RADIX_BITS;
+
+OctreeArena::OctreeArena(const unsigned long chunkSize) : chunkSize(chunkSize), chunk(0), offset(0) {}
+
+Octree *OctreeArena::allocate(const unsigned long count)
+{
+    assert(count <= this->chunkSize);
+    if (this->offset + count > this->chunkSize) { // the current chunk is full, move to the next one
+        this->chunk++;
+        this->offset = 0;
+    }
+    if (this->chunk == this->chunks.size())
+        this->chunks.emplace_back(new Octree[this->chunkSize]);
+
+    Octree *nodes = &this->chunks[this->chunk][this->offset];
+    this->offset += count;
+    return nodes;
+}
+
+void OctreeArena::reset()
+{
+    this->chunk = 0;
+    this->offset = 0;
+}
+
+unsigned long OctreeArena::getReservedBytes() const { return this->chunks.size() * this->chunkSize * sizeof(Octree); }
+
+// a tree with one body per leaf needs a bit less than 4n nodes on the galaxy scheme, reserve that up front
 SimulationNBodyBarnesHut::SimulationNBodyBarnesHut(const unsigned long nBodies, const std::string &scheme, const float soft,
                                            const unsigned long randInit)
-    : SimulationNBodyInterface(nBodies, scheme, soft, randInit)
+    : SimulationNBodyInterface<float>(nBodies, scheme, soft, randInit), arena(4 * nBodies + 8)
 {
     this->flopsPerIte = 30.f * ((float)this->getBodies().getN() * (float)this->getBodies().getN() - (float)this->getBodies().getN())/2;
     this->accelerations.resize(this->getBodies().getN());
     this->softSquared = this->soft * this->soft;
+    this->mortonBuild = false;
+    this->nodeBytes = 0;
+    this->bucketSize = 8;
+    this->refitTolerance = 0;
+    this->rebuildNodes = 0;
+    this->treeOrder = 0;
+    this->quadrupole = false;
+    this->dualTree = false;
+    this->theta = THETA;
+    this->thetaTarget = 0;
+    this->tuningCountdown = 0;
+
+    const unsigned long n = this->getBodies().getN();
+    this->leafBodies.resize(n);
+    this->nextBody.resize(n);
+    this->leafQx.resize(n);
+    this->leafQy.resize(n);
+    this->leafQz.resize(n);
+    this->leafM.resize(n);
+    this->allocatedBytes += n * (2 * sizeof(unsigned) + 4 * sizeof(float));
 }
 
-void SimulationNBodyBarnesHut::freeTree(Octree *tree) {
-    if(tree) {
-        if (tree->internal == false) {
-            free(tree);
-            return;
-        }
+void SimulationNBodyBarnesHut::setBucketSize(const unsigned bucketSize)
+{
+    this->bucketSize = std::max(bucketSize, 1u);
+    this->rebuildNodes = 0;
+}
 
-        for (int i=0;i<8;i++) {
-            
-            this->freeTree(tree->data.internal.children[i]);
-        }
+void SimulationNBodyBarnesHut::setRefitTolerance(const float refitTolerance)
+{
+    this->refitTolerance = std::max(refitTolerance, 0.f);
+    this->rebuildNodes = 0;
+}
+
+bool SimulationNBodyBarnesHut::setQuadrupole(const bool quadrupole)
+{
+    // the quadrupole moments allow a wider opening angle for the same accuracy, this resets `theta` to the default one
+    // the dual tree traversal only carries the monopoles: the moments are refused with it, nothing is changed then
+    if (quadrupole && this->dualTree)
+        return false;
+    this->quadrupole = quadrupole;
+    this->theta = quadrupole ? QUADRUPOLE_THETA : THETA;
+    return true;
+}
+
+bool SimulationNBodyBarnesHut::setDualTree(const bool dualTree)
+{
+    // the traversal prefers bigger leaves, enabling it also sets its default leaf size
+    // like in `setQuadrupole`, it is refused with the quadrupole moments
+    if (dualTree && this->quadrupole)
+        return false;
+    this->dualTree = dualTree;
+    if (dualTree)
+        this->setBucketSize(DUAL_TREE_BUCKET_SIZE);
+    if (dualTree && this->leafAx.empty()) {
+        const unsigned long n = this->getBodies().getN();
+        this->leafAx.resize(n);
+        this->leafAy.resize(n);
+        this->leafAz.resize(n);
+        this->allocatedBytes += 3 * n * sizeof(float);
+    }
+    return true;
+}
+
+void SimulationNBodyBarnesHut::setTheta(const float theta)
+{
+    this->theta = theta;
+}
+
+void SimulationNBodyBarnesHut::setThetaTarget(const float thetaTarget)
+{
+    this->thetaTarget = std::max(thetaTarget, 0.f);
+    this->tuningCountdown = 0;
+}
+
+float SimulationNBodyBarnesHut::getTheta() const
+{
+    return this->theta;
+}
 
-        free(tree);
+void SimulationNBodyBarnesHut::setMortonBuild(const bool mortonBuild)
+{
+    this->mortonBuild = mortonBuild;
+    if (mortonBuild && this->mortonKeys.empty()) {
+        const unsigned long n = this->getBodies().getN();
+        this->mortonKeys.resize(n);
+        this->mortonKeysTmp.resize(n);
+        this->mortonOrder.resize(n);
+        this->mortonOrderTmp.resize(n);
+        this->radixCount.resize(RADIX_PASSES * RADIX_SIZE);
+        this->allocatedBytes += n * 2 * (sizeof(uint64_t) + sizeof(unsigned));
     }
 }
 
+unsigned long SimulationNBodyBarnesHut::getNodeBytes() const
+{
+    return this->arena.getReservedBytes() + this->flatTree.capacity() * sizeof(FlatNode) +
+           this->quadrupoles.capacity() * sizeof(Quadrupole) + this->localFields.capacity() * sizeof(LocalField);
+}
+
+void SimulationNBodyBarnesHut::updateAllocatedBytes()
+{
+    // the arenas never shrink, so adding their growth keeps track of the peak node memory
+    const unsigned long nodeBytes = this->getNodeBytes();
+    this->allocatedBytes += nodeBytes - this->nodeBytes;
+    this->nodeBytes = nodeBytes;
+}
+
 void SimulationNBodyBarnesHut::initIteration()
 {
     for (unsigned long iBody = 0; iBody < this->getBodies().getN(); iBody++) {
@@ -40,128 +165,407 @@ void SimulationNBodyBarnesHut::initIteration()
         this->accelerations[iBody].az = 0.f;
     }
     this->computeOctree();
+    if (this->quadrupole)
+        this->computeQuadrupoles();
+    if (this->thetaTarget > 0 && this->tuningCountdown-- == 0) {
+        this->tuneTheta();
+        this->tuningCountdown = THETA_TUNING_PERIOD - 1;
+    }
 }
-void SimulationNBodyBarnesHut::getBoundingBox(float *min_x_,float *max_x_,float *min_y_,float *max_y_,float *min_z_,float *max_z_) {
-    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
-    float min_x = d[0].qx, max_x = d[0].qx, min_y = d[0].qy, max_y = d[0].qy, min_z = d[0].qz, max_z = d[0].qz;
 
-    unsigned long n_bodies = this->getBodies().getN();
+void SimulationNBodyBarnesHut::computeTuningReference()
+{
+    // direct sum over all the bodies for the sampled ones, one register of samples at a time
+    constexpr int N = mipp::N<float>();
+    const dataSoA_t<float> &d = this->getBodies().getDataSoA();
+    const unsigned long n_bodies = this->getBodies().getN();
+    const unsigned n_samples = this->tuningBodies.size();
+    const mipp::Reg<float> softSquared_v = this->softSquared;
+    const mipp::Reg<float> G_v = this->G;
+
+    for (unsigned s=0;s<n_samples;s+=N) {
+        // the lanes past the last sample repeat it and are dropped
+        float sqx[N], sqy[N], sqz[N];
+        for (int k=0;k<N;k++) {
+            const unsigned b = this->leafBodies[this->tuningBodies[std::min(s + k, n_samples - 1)]];
+            sqx[k] = d.qx[b];
+            sqy[k] = d.qy[b];
+            sqz[k] = d.qz[b];
+        }
+        mipp::Reg<float> i_qx, i_qy, i_qz;
+        i_qx.loadu(sqx);
+        i_qy.loadu(sqy);
+        i_qz.loadu(sqz);
+        mipp::Reg<float> ax = 0.0, ay = 0.0, az = 0.0;
+        for (unsigned long j=0;j<n_bodies;j++)
+            accumulateAccelerationSIMD(i_qx, i_qy, i_qz, d.qx[j], d.qy[j], d.qz[j], d.m[j], softSquared_v, G_v, ax,
+                                       ay, az);
 
-    for (unsigned long i=0;i<n_bodies;i++) {
-        if (d[i].qx > max_x)
-            max_x = d[i].qx;
-        if (d[i].qx < min_x)
-            min_x = d[i].qx;
-        if (d[i].qy > max_y)
-            max_y = d[i].qy;
-        if (d[i].qy < min_y)
-            min_y = d[i].qy;
-        if (d[i].qz > max_z)
-            max_z = d[i].qz;
-        if (d[i].qz < min_z)
-            min_z = d[i].qz;
-    }
-
-    *min_x_ = min_x;
-    *max_x_ = max_x;
-    *min_y_ = min_y;
-    *max_y_ = max_y;
-    *min_z_ = min_z;
-    *max_z_ = max_z;
-
-
-}
-
-void SimulationNBodyBarnesHut::insertBody(Octree* tree, const dataAoS_t<float> *body) {
-    if (tree->internal == false) { //End case : external node
-        if (tree->data.external.body == NULL) {
-            tree->data.external.body = body;
-            tree->CoMx = body->qx;   //update right now CoM and mass
-            tree->CoMy = body->qy;
-            tree->CoMz = body->qz;
-            tree->mass = body->m;
+        float tabx[N], taby[N], tabz[N];
+        ax.storeu(tabx);
+        ay.storeu(taby);
+        az.storeu(tabz);
+        for (int k=0;k<N && s+k<n_samples;k++) {
+            this->tuningAx[s + k] = tabx[k];
+            this->tuningAy[s + k] = taby[k];
+            this->tuningAz[s + k] = tabz[k];
+        }
+    }
+}
+
+float SimulationNBodyBarnesHut::computeTuningError(const float theta)
+{
+    // root mean square of the relative errors of the walk with `theta` on the sampled bodies
+    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+    const float savedTheta = this->theta;
+    this->theta = theta;
+    if (this->dualTree)
+        this->computeDualTreeGroups(this->tuningGroups);
+    double error = 0;
+    const unsigned n_samples = this->tuningBodies.size();
+    for (unsigned s=0;s<n_samples;s++) {
+        float ax = 0, ay = 0, az = 0;
+        if (this->dualTree) {
+            ax = this->leafAx[this->tuningBodies[s]];
+            ay = this->leafAy[this->tuningBodies[s]];
+            az = this->leafAz[this->tuningBodies[s]];
         } else {
-            const dataAoS_t<float> *other_body = tree->data.external.body;
-            // printf("body 1 : %e %e %e\n",body->qx,body->qy,body->qz);
-            // printf("body 2 : %e %e %e\n",other_body->qx,other_body->qy,other_body->qz);
-
-            tree->internal = true;
-            // printf("constructing child %e\n",tree->size);
-            for (int i=0;i<8;i++) {
-                Octree *child = (Octree*) malloc(sizeof(Octree));
-                child->internal = false; //Newly created child are external
-                child->size = tree->size / 2;
-                const float size_increment = child->size / 2;
-                child->mass = 0; //we put the mass at 0 to simplify all later computation
-                if (i % 2) { //new_x > x
-                    child->qx = tree->qx + size_increment;
-                } else {
-                    child->qx = tree->qx - size_increment;
-                }
-
-                if (i % 4 > 1) {
-                    child->qy = tree->qy + size_increment;
-                } else {
-                    child->qy = tree->qy - size_increment;
-                }
-
-                if (i > 3) {
-                    child->qz = tree->qz + size_increment;
-                } else {
-                    child->qz = tree->qz - size_increment;
-                }
-
-                child->data.external.body = NULL;
-                tree->data.internal.children[i] = child;
-            }
+            this->computeBodyAcceleration(&d[this->leafBodies[this->tuningBodies[s]]], &ax, &ay, &az);
+        }
+        const double ex = ax - this->tuningAx[s], ey = ay - this->tuningAy[s], ez = az - this->tuningAz[s];
+        const double norm = (double)this->tuningAx[s] * this->tuningAx[s] + (double)this->tuningAy[s] *
+                            this->tuningAy[s] + (double)this->tuningAz[s] * this->tuningAz[s];
+        if (norm > 0)
+            error += (ex * ex + ey * ey + ez * ez) / norm;
+    }
+    this->theta = savedTheta;
+    return std::sqrt(error / n_samples);
+}
 
-            this->insertBody(tree,other_body); //Now that we have changed the type of the node we reinsert the original body, and the new one
-            this->insertBody(tree,body);       //They will go on to the good external node.
-            // this->updateTree(tree);
+void SimulationNBodyBarnesHut::tuneTheta()
+{
+    // The error of the walk grows with the opening angle: bisect for the largest one that meets the target on a
+    // sample of bodies spread over the whole set (in the tree order), checked against the direct sum.
+    const unsigned long n_bodies = this->getBodies().getN();
+    const unsigned n_samples = std::min(n_bodies, (unsigned long)THETA_TUNING_SAMPLES);
+    this->tuningBodies.resize(n_samples);
+    this->tuningAx.resize(n_samples);
+    this->tuningAy.resize(n_samples);
+    this->tuningAz.resize(n_samples);
+    for (unsigned s=0;s<n_samples;s++)
+        this->tuningBodies[s] = (2 * s + 1) * n_bodies / (2 * n_samples);
+    this->computeTuningReference();
 
+    if (this->dualTree) {
+        // the cells interact pairwise, so there is no walk of a single body: the groups of the traversal that hold a
+        // sample are computed as a whole, the groups and the samples both follow the tree order
+        this->localFields.resize(this->flatTree.size());
+        this->updateAllocatedBytes();
+        this->splitDualTree();
+        this->tuningGroups.clear();
+        unsigned s = 0;
+        for (unsigned g=0;g<this->dualTreeGroups.size() && s<n_samples;g++) {
+            const FlatNode &node = this->flatTree[this->dualTreeGroups[g]];
+            if (this->tuningBodies[s] >= node.first + node.count)
+                continue;
+            this->tuningGroups.push_back(this->dualTreeGroups[g]);
+            while (s < n_samples && this->tuningBodies[s] < node.first + node.count)
+                s++;
         }
+    }
+
+    if (this->computeTuningError(THETA_MAX) <= this->thetaTarget) {
+        this->theta = THETA_MAX;
         return;
     }
-    //we go to the next group.
-    int index = 0;
-    index += (body->qx > tree->qx) * 1; //Permet de donner un indice différent selon tout les cas, de 0 à 7
-    index += (body->qy > tree->qy) * 2;
-    index += (body->qz > tree->qz) * 4;
+    float lo = THETA_MIN, hi = THETA_MAX;
+    for (int step=0;step<THETA_TUNING_STEPS;step++) {
+        const float mid = (lo + hi) / 2;
+        if (this->computeTuningError(mid) <= this->thetaTarget)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    this->theta = lo;
+}
+void SimulationNBodyBarnesHut::getBoundingBox(float *min_x_,float *max_x_,float *min_y_,float *max_y_,float *min_z_,float *max_z_) {
+    float min[3], max[3];
+    this->getBodies().getBoundingBox(min, max);
 
-    // printf("center : %e %e %e\n",tree->qx,tree->qy,tree->qz);
-    // printf("%e %e %e going to %d\n",body->qx,body->qy,body->qz,index);
+    *min_x_ = min[0];
+    *max_x_ = max[0];
+    *min_y_ = min[1];
+    *max_y_ = max[1];
+    *min_z_ = min[2];
+    *max_z_ = max[2];
+}
 
-    this->insertBody(tree->data.internal.children[index], body);
-    // this->updateTree(tree);
+void SimulationNBodyBarnesHut::splitNode(OctreeArena &arena, Octree* tree) {
+    tree->internal = true;
+    // printf("constructing child %e\n",tree->size);
+    Octree *children = arena.allocate(8);
+    for (int i=0;i<8;i++) {
+        Octree *child = &children[i];
+        child->internal = false; //Newly created child are external
+        child->size = tree->size / 2;
+        const float size_increment = child->size / 2;
+        child->mass = 0; //we put the mass at 0 to simplify all later computation
+        if (i % 2) { //new_x > x
+            child->qx = tree->qx + size_increment;
+        } else {
+            child->qx = tree->qx - size_increment;
+        }
+
+        if (i % 4 > 1) {
+            child->qy = tree->qy + size_increment;
+        } else {
+            child->qy = tree->qy - size_increment;
+        }
+
+        if (i > 3) {
+            child->qz = tree->qz + size_increment;
+        } else {
+            child->qz = tree->qz - size_increment;
+        }
+
+        child->count = 0;
+    }
+    tree->data.children = children;
+}
+
+void SimulationNBodyBarnesHut::setLeafBodies(Octree* leaf, const unsigned first, const unsigned count) {
+    leaf->data.first = first;
+    leaf->count = count;
 }
 
-void SimulationNBodyBarnesHut::updateTree(Octree* tree) { //Could probably be fused with `insertBody`
-    if (tree->internal == false) 
+void SimulationNBodyBarnesHut::insertBody(OctreeArena &arena, Octree* tree, int level, const unsigned body) {
+    //we go down to the external node of the body
+    const dataAoS_t<float> &b = this->getBodies().getDataAoS()[body];
+    while (tree->internal) {
+        level++;
+        int index = 0;
+        index += (b.qx > tree->qx) * 1; //Permet de donner un indice différent selon tout les cas, de 0 à 7
+        index += (b.qy > tree->qy) * 2;
+        index += (b.qz > tree->qz) * 4;
+        tree = &tree->data.children[index];
+    }
+
+    // the bodies closer than the finest Morton cell stay in an oversized leaf, like in `buildMortonTree`, otherwise
+    // more than `bucketSize` bodies at the same position would split forever
+    if (tree->count < this->bucketSize || level == MORTON_LEVELS) { // push the body on the list of the leaf
+        this->nextBody[body] = tree->data.first;
+        tree->data.first = body;
+        tree->count++;
         return;
+    }
+
+    // the list is in reverse insertion order, reverse it so that the bodies are reinserted in their order
+    const unsigned count = tree->count;
+    unsigned other_body = tree->data.first, reversed = 0;
+    for (unsigned i=0;i<count;i++) {
+        const unsigned next_body = this->nextBody[other_body];
+        this->nextBody[other_body] = reversed;
+        reversed = other_body;
+        other_body = next_body;
+    }
+
+    this->splitNode(arena, tree);
 
+    //Now that we have changed the type of the node we reinsert the original bodies, and the new one
+    //They will go on to the good external node.
+    other_body = reversed;
+    for (unsigned i=0;i<count;i++) {
+        const unsigned next_body = this->nextBody[other_body];
+        this->insertBody(arena,tree,level,other_body);
+        other_body = next_body;
+    }
+    this->insertBody(arena,tree,level,body);
+}
+
+unsigned SimulationNBodyBarnesHut::packLeaves(Octree* tree, unsigned offset) {
+    // moves the lists of the insertion build to `leafBodies` from `offset`, in depth-first order
+    if (tree->internal) {
+        for (int i=0;i<8;i++)
+            offset = this->packLeaves(&tree->data.children[i], offset);
+        return offset;
+    }
 
+    // the lists are in reverse insertion order
+    unsigned body = tree->data.first;
+    for (unsigned i=tree->count;i>0;i--) {
+        this->leafBodies[offset + i - 1] = body;
+        body = this->nextBody[body];
+    }
+    tree->data.first = offset;
+    return offset + tree->count;
+}
+
+void SimulationNBodyBarnesHut::packBodies(const unsigned long begin, const unsigned long end) {
+    // gathers the bodies in the `leafBodies` order, so that the walks read the bodies of a leaf contiguously
+    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+    for (unsigned long i=begin;i<end;i++) {
+        const dataAoS_t<float> &b = d[this->leafBodies[i]];
+        this->leafQx[i] = b.qx;
+        this->leafQy[i] = b.qy;
+        this->leafQz[i] = b.qz;
+        this->leafM[i] = b.m;
+    }
+}
+
+unsigned SimulationNBodyBarnesHut::updateTree(Octree* tree) { //Could probably be fused with `insertBody`
+    // returns the number of non-empty nodes of the subtree, i.e. its size once flattened
     float CoMx = 0,CoMy=0, CoMz=0, mass = 0;
-    for (int i=0;i<8;i++) {
-        this->updateTree(tree->data.internal.children[i]);
-        float child_mass = tree->data.internal.children[i]->mass;
-        CoMx += tree->data.internal.children[i]->CoMx * child_mass;
-        CoMy += tree->data.internal.children[i]->CoMy * child_mass;
-        CoMz += tree->data.internal.children[i]->CoMz * child_mass;
-        mass += child_mass;
+    unsigned count = 1;
+    if (tree->internal == false) {
+        const unsigned end = tree->data.first + tree->count;
+        for (unsigned i=tree->data.first;i<end;i++) {
+            CoMx += this->leafQx[i] * this->leafM[i];
+            CoMy += this->leafQy[i] * this->leafM[i];
+            CoMz += this->leafQz[i] * this->leafM[i];
+            mass += this->leafM[i];
+        }
+    } else {
+        tree->count = 0;
+        for (int i=0;i<8;i++) {
+            count += this->updateTree(&tree->data.children[i]);
+            tree->count += tree->data.children[i].count;
+            float child_mass = tree->data.children[i].mass;
+            CoMx += tree->data.children[i].CoMx * child_mass;
+            CoMy += tree->data.children[i].CoMy * child_mass;
+            CoMz += tree->data.children[i].CoMz * child_mass;
+            mass += child_mass;
 
+        }
     }
 
-    CoMx /= mass;
-    CoMy /= mass;
-    CoMz /= mass;
+    this->setCenterOfMass(tree, CoMx, CoMy, CoMz, mass);
+    return tree->count != 0 ? count : 0;
+}
+
+void SimulationNBodyBarnesHut::setCenterOfMass(Octree* tree, const float CoMx, const float CoMy, const float CoMz,
+                                               const float mass) {
+    // the center of a massless group does not matter, but it must not be a NaN as it is still walked
     tree->mass = mass;
-    tree->CoMx = CoMx;
-    tree->CoMy = CoMy;
-    tree->CoMz = CoMz;
+    tree->CoMx = mass != 0 ? CoMx / mass : tree->qx;
+    tree->CoMy = mass != 0 ? CoMy / mass : tree->qy;
+    tree->CoMz = mass != 0 ? CoMz / mass : tree->qz;
 }
 
-void SimulationNBodyBarnesHut::computeOctree() {
-    // clock_t begin = clock();
+unsigned SimulationNBodyBarnesHut::flattenTree(const Octree* tree, unsigned index) {
+    // writes the subtree in depth-first order from `index` and returns the index following it
+    if (tree->count == 0)
+        return index;
+
+    FlatNode &node = this->flatTree[index];
+    node.CoMx = tree->CoMx;
+    node.CoMy = tree->CoMy;
+    node.CoMz = tree->CoMz;
+    node.mass = tree->mass;
+    node.sizeSquared = tree->size * tree->size;
+    node.count = tree->count;
+
+    unsigned next = index + 1;
+    if (tree->internal) {
+        for (int i=0;i<8;i++)
+            next = this->flattenTree(&tree->data.children[i], next);
+        node.first = this->flatTree[index + 1].first; // the bodies of a subtree start with the ones of its first child
+    } else {
+        node.first = tree->data.first;
+    }
+    node.next = next;
+    return next;
+}
+
+// spread the 21 low bits of `v` so that there are two zero bits between each of them
+static inline uint64_t expandBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+// octant of the key at a given level, with the same numbering as the children in `insertBody`
+static inline int mortonDigit(uint64_t key, int level) {
+    return (key >> (3 * (MORTON_LEVELS - 1 - level))) & 7;
+}
+
+void SimulationNBodyBarnesHut::computeMortonKeys(const unsigned long begin, const unsigned long end) {
+    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+
+    // the keys are the coordinates of the bodies in the root cube quantized on 2^21 cells per dimension
+    const float half = this->tree->size / 2;
+    const float min_x = this->tree->qx - half, min_y = this->tree->qy - half, min_z = this->tree->qz - half;
+    const float cells = (float)(1 << MORTON_LEVELS);
+    const float scale = this->tree->size > 0 ? cells / this->tree->size : 0;
+
+    for (unsigned long i=begin;i<end;i++) {
+        const float x = std::min(std::max((d[i].qx - min_x) * scale, 0.f), cells - 1);
+        const float y = std::min(std::max((d[i].qy - min_y) * scale, 0.f), cells - 1);
+        const float z = std::min(std::max((d[i].qz - min_z) * scale, 0.f), cells - 1);
+        this->mortonKeys[i] = expandBits((uint64_t)x) | expandBits((uint64_t)y) << 1 | expandBits((uint64_t)z) << 2;
+        this->mortonOrder[i] = i;
+    }
+}
+
+void SimulationNBodyBarnesHut::sortMortonKeys() {
+    // LSD radix sort, one histogram per digit
+    unsigned long n_bodies = this->getBodies().getN();
+
+    // all the histograms are computed in a single read of the keys
+    std::vector<unsigned long> &count = this->radixCount;
+    std::fill(count.begin(), count.end(), 0);
+    for (unsigned long i=0;i<n_bodies;i++)
+        for (int p=0;p<RADIX_PASSES;p++)
+            count[p * RADIX_SIZE + ((this->mortonKeys[i] >> (p * RADIX_BITS)) & (RADIX_SIZE - 1))]++;
+
+    for (int p=0;p<RADIX_PASSES;p++) {
+        unsigned long *c = &count[p * RADIX_SIZE];
+        const int shift = p * RADIX_BITS;
+        if (c[(this->mortonKeys[0] >> shift) & (RADIX_SIZE - 1)] == n_bodies)
+            continue; // every key has the same digit, this pass would not move anything
+
+        unsigned long offset = 0;
+        for (unsigned b=0;b<RADIX_SIZE;b++) {
+            const unsigned long tmp = c[b];
+            c[b] = offset;
+            offset += tmp;
+        }
+        for (unsigned long i=0;i<n_bodies;i++) {
+            const unsigned long dst = c[(this->mortonKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+            this->mortonKeysTmp[dst] = this->mortonKeys[i];
+            this->mortonOrderTmp[dst] = this->mortonOrder[i];
+        }
+        std::swap(this->mortonKeys, this->mortonKeysTmp);
+        std::swap(this->mortonOrder, this->mortonOrderTmp);
+    }
+}
+
+void SimulationNBodyBarnesHut::buildMortonTree(OctreeArena &arena, Octree *node, const int level,
+                                               const unsigned long begin, const unsigned long end) {
+    // builds the subtree of `node`, a node of depth `level` holding the sorted bodies [begin, end)
+    if (end - begin <= this->bucketSize || level == MORTON_LEVELS) {
+        // past the deepest level, the bodies share the same key and are left in an oversized leaf
+        this->setLeafBodies(node, begin, end - begin);
+        return;
+    }
+
+    // the keys of the node share their first `level` octants, so each child holds a contiguous range of them
+    const uint64_t *keys = this->mortonKeys.data();
+    this->splitNode(arena, node);
+    unsigned long child_begin = begin;
+    for (int i=0;i<8;i++) {
+        const unsigned long child_end = std::partition_point(keys + child_begin, keys + end,
+            [level, i](const uint64_t key) { return mortonDigit(key, level) <= i; }) - keys;
+        if (child_end != child_begin)
+            this->buildMortonTree(arena, &node->data.children[i], level + 1, child_begin, child_end);
+        child_begin = child_end;
+    }
+}
+
+void SimulationNBodyBarnesHut::initRoot(OctreeArena &arena) {
     float min_x,max_x,min_y,max_y,min_z,max_z;
     this->getBoundingBox(&min_x,&max_x,&min_y,&max_y,&min_z,&max_z);
 
@@ -177,27 +581,116 @@ void SimulationNBodyBarnesHut::computeOctree() {
 
     if (size_z > size)
         size = size_z;
+    if (this->refitTolerance > 0)
+        size *= 1 + REFIT_MARGIN;
 
 
-    this->tree = (Octree*) malloc(sizeof(Octree));
+    this->tree = arena.allocate(1);
     this->tree->size = size;
     this->tree->qx = (max_x - min_x) / 2 + min_x;
     this->tree->qy = (max_y - min_y) / 2 + min_y;
     this->tree->qz = (max_z - min_z) / 2 + min_z;
     this->tree->internal = false;
-    this->tree->data.external.body = NULL;
+    this->tree->count = 0;
     // printf("bouding box : %e %e,  %e %e,  %e %e\n",min_x,max_x,min_y,max_y,min_z,max_z);
     // printf("Created tree of size %e, at %e %e %e\n",size,this->tree->qx,this->tree->qy,this->tree->qz );
+}
+
+bool SimulationNBodyBarnesHut::refitOctree() {
+    // Updates the tree of the previous iteration to the new positions: the cells do not move, only the bodies that
+    // left the cell of their leaf are inserted again. Returns false if the tree has to be rebuilt instead.
+    if (this->refitTolerance == 0)
+        return false;
+    if (this->treeOrder != this->getBodies().getReorderCount()) {
+        this->treeOrder = this->getBodies().getReorderCount();
+        return false; // the bodies moved in memory, the leaves hold their old indices
+    }
+    if (this->rebuildNodes == 0)
+        return false;
+
+    float min_x,max_x,min_y,max_y,min_z,max_z;
+    this->getBoundingBox(&min_x,&max_x,&min_y,&max_y,&min_z,&max_z);
+    const float half = this->tree->size / 2;
+    if (min_x < this->tree->qx - half || max_x > this->tree->qx + half ||
+        min_y < this->tree->qy - half || max_y > this->tree->qy + half ||
+        min_z < this->tree->qz - half || max_z > this->tree->qz + half)
+        return false; // a body left the root cell
+
+    this->escapedBodies.clear();
+    const float lo[3] = {-INFINITY, -INFINITY, -INFINITY};
+    const float hi[3] = {INFINITY, INFINITY, INFINITY};
+    this->refitLeaves(this->tree, lo, hi);
+    for (unsigned body : this->escapedBodies)
+        this->insertBody(this->arena, this->tree, 0, body);
+
+    const unsigned long n_bodies = this->getBodies().getN();
+    this->packLeaves(this->tree, 0);
+    this->packBodies(0, n_bodies);
+    this->flatTree.resize(this->updateTree(this->tree));
+    this->flattenTree(this->tree, 0);
+    this->updateAllocatedBytes();
+
+    // the emptied cells are not merged back, the next iteration rebuilds once the tree has grown too much
+    if (this->flatTree.size() > (1 + this->refitTolerance) * this->rebuildNodes)
+        this->rebuildNodes = 0;
+    return true;
+}
 
+void SimulationNBodyBarnesHut::refitLeaves(Octree* tree, const float *lo, const float *hi) {
+    // `lo` and `hi` bound the cell of `tree` as `insertBody` sees it: a body belongs to it if lo < q <= hi
+    if (tree->internal) {
+        for (int i=0;i<8;i++) {
+            const float child_lo[3] = {(i & 1) ? tree->qx : lo[0], (i & 2) ? tree->qy : lo[1], (i & 4) ? tree->qz : lo[2]};
+            const float child_hi[3] = {(i & 1) ? hi[0] : tree->qx, (i & 2) ? hi[1] : tree->qy, (i & 4) ? hi[2] : tree->qz};
+            this->refitLeaves(&tree->data.children[i], child_lo, child_hi);
+        }
+        return;
+    }
+
+    // the bodies that stay go back to a list, in the same order
     const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+    const unsigned end = tree->data.first + tree->count;
+    unsigned head = 0, count = 0;
+    for (unsigned i=tree->data.first;i<end;i++) {
+        const unsigned body = this->leafBodies[i];
+        if (d[body].qx > lo[0] && d[body].qx <= hi[0] && d[body].qy > lo[1] && d[body].qy <= hi[1] &&
+            d[body].qz > lo[2] && d[body].qz <= hi[2]) {
+            this->nextBody[body] = head;
+            head = body;
+            count++;
+        } else {
+            this->escapedBodies.push_back(body);
+        }
+    }
+    tree->data.first = head;
+    tree->count = count;
+}
+
+void SimulationNBodyBarnesHut::computeOctree() {
+    // clock_t begin = clock();
+    if (this->refitOctree())
+        return;
+
+    this->arena.reset();
+    this->initRoot(this->arena);
 
     unsigned long n_bodies = this->getBodies().getN();
-    for (unsigned long i=0;i<n_bodies;i++) {
-        // printf("inserting body %e %e %e\n",d[i].qx,d[i].qy,d[i].qz);
-        this->insertBody(this->tree,&d[i]);
+    if (this->mortonBuild) {
+        this->computeMortonKeys(0, n_bodies);
+        this->sortMortonKeys();
+        this->buildMortonTree(this->arena, this->tree, 0, 0, n_bodies);
+        this->leafBodies.swap(this->mortonOrder); // the sorted bodies are the depth-first order of the leaves
+    } else {
+        for (unsigned long i=0;i<n_bodies;i++)
+            this->insertBody(this->arena,this->tree,0,i);
+        this->packLeaves(this->tree, 0);
     }
+    this->packBodies(0, n_bodies);
     // clock_t end_1 = clock();
-    this->updateTree(this->tree);
+    this->flatTree.resize(this->updateTree(this->tree));
+    this->flattenTree(this->tree, 0);
+    this->updateAllocatedBytes();
+    this->rebuildNodes = this->flatTree.size();
     // clock_t end = clock();
     // double time_spent = (double)(end - begin) / CLOCKS_PER_SEC;
     // double time_spent_1 = (double)(end_1 - begin) / CLOCKS_PER_SEC;
@@ -210,64 +703,400 @@ void SimulationNBodyBarnesHut::computeOctree() {
 
 }
 
-void SimulationNBodyBarnesHut::computeBodyAcceleration(Octree *tree,const dataAoS_t<float> *body,float *ax, float *ay, float *az, int depth) {
-    // printf("    entering node %e %e %e , size=%e, depth=%d\n",tree->qx,tree->qy,tree->qz,tree->size,depth);
-    if (tree->internal == false) {
-        if (tree->mass != 0) { 
-            // printf("        with body %e %e %e of mass %e\n",tree->CoMx,tree->CoMy,tree->CoMz,tree->mass);
-            const float rijx = tree->CoMx - body->qx; // 1 flop
-            const float rijy = tree->CoMy - body->qy; // 1 flop
-            const float rijz = tree->CoMz - body->qz; // 1 flop
+void SimulationNBodyBarnesHut::computeLeafQuadrupole(const unsigned index) {
+    const FlatNode &node = this->flatTree[index];
+    Quadrupole q = {0, 0, 0, 0, 0, 0};
+    const float invMass = node.mass != 0 ? 1.f / node.mass : 0.f;
+    const unsigned end = node.first + node.count;
+    for (unsigned i=node.first;i<end;i++) {
+        const float w = this->leafM[i] * invMass;
+        const float dx = this->leafQx[i] - node.CoMx;
+        const float dy = this->leafQy[i] - node.CoMy;
+        const float dz = this->leafQz[i] - node.CoMz;
+        q.xx += w * dx * dx;
+        q.xy += w * dx * dy;
+        q.xz += w * dx * dz;
+        q.yy += w * dy * dy;
+        q.yz += w * dy * dz;
+        q.zz += w * dz * dz;
+    }
+    this->quadrupoles[index] = q;
+}
+
+void SimulationNBodyBarnesHut::computeInternalQuadrupole(const unsigned index) {
+    // parallel axis theorem: the moments of each child are moved from its center of mass to the one of the node
+    const FlatNode &node = this->flatTree[index];
+    Quadrupole q = {0, 0, 0, 0, 0, 0};
+    const float invMass = node.mass != 0 ? 1.f / node.mass : 0.f;
+    for (unsigned j=index+1;j<node.next;j=this->flatTree[j].next) {
+        const FlatNode &child = this->flatTree[j];
+        const Quadrupole &c = this->quadrupoles[j];
+        const float w = child.mass * invMass;
+        const float dx = child.CoMx - node.CoMx;
+        const float dy = child.CoMy - node.CoMy;
+        const float dz = child.CoMz - node.CoMz;
+        q.xx += w * (c.xx + dx * dx);
+        q.xy += w * (c.xy + dx * dy);
+        q.xz += w * (c.xz + dx * dz);
+        q.yy += w * (c.yy + dy * dy);
+        q.yz += w * (c.yz + dy * dz);
+        q.zz += w * (c.zz + dz * dz);
+    }
+    this->quadrupoles[index] = q;
+}
+
+void SimulationNBodyBarnesHut::computeQuadrupoles() {
+    // the children of a node follow it in the flat tree, so a backward sweep always finds them already computed
+    const unsigned n_nodes = this->flatTree.size();
+    this->quadrupoles.resize(n_nodes);
+    for (unsigned i=n_nodes;i-->0;) {
+        if (this->flatTree[i].next == i + 1)
+            this->computeLeafQuadrupole(i);
+        else
+            this->computeInternalQuadrupole(i);
+    }
+    this->updateAllocatedBytes();
+}
 
-            const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz; // 5 flops
+unsigned SimulationNBodyBarnesHut::computeBodyAcceleration(const dataAoS_t<float> *body,float *ax, float *ay, float *az) {
+    // Depth-first walk of the flattened tree: an accepted node is skipped with its `next` index, an opened one continues
+    // with its first child which is the following node. An opened leaf has no children, its bodies are summed directly.
+    // Returns the cost of the walk: the number of nodes visited and of bodies summed.
+    const FlatNode *nodes = this->flatTree.data();
+    const Quadrupole *quadrupoles = this->quadrupoles.data();
+    const unsigned n_nodes = this->flatTree.size();
+    const float theta = this->theta;
+    float aix = *ax, aiy = *ay, aiz = *az;
 
+    unsigned i = 0, cost = 0;
+    while (i < n_nodes) {
+        const FlatNode &node = nodes[i];
+        cost++;
+        const float rijx = node.CoMx - body->qx; // 1 flop
+        const float rijy = node.CoMy - body->qy; // 1 flop
+        const float rijz = node.CoMz - body->qz; // 1 flop
+
+        const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz; // 5 flops
+
+        // s/d < theta <=> s^2 / d^2 < theta^2, because everything is >= 0
+        if (node.sizeSquared / rijSquared <= theta * theta) {
             // compute the acceleration value between body i and body j: || ai || = G.mj / (|| rij ||² + e²)^{3/2}
             const float x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
-            const float ai = x * tree->mass; // 1 flops
+            float ai = x * node.mass; // 1 flops
+
+            if (this->quadrupole) {
+                // second order term of the expansion of the softened potential around the center of mass, with
+                // s = || rij ||² + e² and S the moments of the node: G.mj / s^{3/2} times
+                // 15/2 (rij.S.rij) / s² rij - 3/2 tr(S) / s rij - 3 S.rij / s
+                // every product is divided by s as soon as possible to stay in the range of a float
+                const Quadrupole &q = quadrupoles[i];
+                const float inv = 1.f / (rijSquared + softSquared);
+                const float sx = (q.xx * rijx + q.xy * rijy + q.xz * rijz) * inv;
+                const float sy = (q.xy * rijx + q.yy * rijy + q.yz * rijz) * inv;
+                const float sz = (q.xz * rijx + q.yz * rijy + q.zz * rijz) * inv;
+                const float rSr = (rijx * sx + rijy * sy + rijz * sz) * inv;
+                aix -= 3.f * ai * sx;
+                aiy -= 3.f * ai * sy;
+                aiz -= 3.f * ai * sz;
+                ai *= 1.f + 7.5f * rSr - 1.5f * (q.xx + q.yy + q.zz) * inv;
+            }
+
+            aix += ai * rijx;
+            aiy += ai * rijy;
+            aiz += ai * rijz;
+            i = node.next;
+        } else if (node.next == i + 1) { // leaf too close to use its center of mass, sum its bodies directly
+            const unsigned end = node.first + node.count;
+            cost += node.count;
+            for (unsigned j=node.first;j<end;j++) {
+                const float rjx = this->leafQx[j] - body->qx;
+                const float rjy = this->leafQy[j] - body->qy;
+                const float rjz = this->leafQz[j] - body->qz;
+                const float rjSquared = rjx * rjx + rjy * rjy + rjz * rjz;
+                const float x = this->G / ((rjSquared + softSquared) * std::sqrt(rjSquared + softSquared));
+                const float aj = x * this->leafM[j];
 
-            *ax += ai * rijx;
-            *ay += ai * rijy;
-            *az += ai * rijz;
-            // printf("    ax += %e  = %e\n",ai * rijx, *ax);
+                aix += aj * rjx;
+                aiy += aj * rjy;
+                aiz += aj * rjz;
+            }
+            i = node.next;
+        } else { //We don't use this group
+            i++;
+        }
+    }
+
+    *ax = aix;
+    *ay = aiy;
+    *az = aiz;
+    return cost;
+}
+
+void SimulationNBodyBarnesHut::cellToCell(const unsigned target, const unsigned source) {
+    // field of the center of mass of `source` at the one of `target`, with its gradient for the bodies around it
+    const FlatNode &a = this->flatTree[target];
+    const FlatNode &b = this->flatTree[source];
+    LocalField &field = this->localFields[target];
+    const float rijx = b.CoMx - a.CoMx;
+    const float rijy = b.CoMy - a.CoMy;
+    const float rijz = b.CoMz - a.CoMz;
+    const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+    const float inv = 1.f / (rijSquared + this->softSquared);
+    const float ai = this->G * b.mass * inv * std::sqrt(inv); // G.mj / (|| rij ||² + e²)^{3/2}
+    const float ai_3 = 3.f * ai * inv;
+
+    field.ax += ai * rijx;
+    field.ay += ai * rijy;
+    field.az += ai * rijz;
+    field.xx += ai_3 * rijx * rijx - ai;
+    field.xy += ai_3 * rijx * rijy;
+    field.xz += ai_3 * rijx * rijz;
+    field.yy += ai_3 * rijy * rijy - ai;
+    field.yz += ai_3 * rijy * rijz;
+    field.zz += ai_3 * rijz * rijz - ai;
+}
+
+void SimulationNBodyBarnesHut::leafToLeaf(const unsigned target, const unsigned source) {
+    // the bodies of `target` that are far enough from `source` still use its center of mass, like in the walk
+    const FlatNode &a = this->flatTree[target];
+    const FlatNode &b = this->flatTree[source];
+    for (unsigned i=a.first;i<a.first+a.count;i++) {
+        float aix = 0, aiy = 0, aiz = 0;
+        const float rx = b.CoMx - this->leafQx[i];
+        const float ry = b.CoMy - this->leafQy[i];
+        const float rz = b.CoMz - this->leafQz[i];
+        const float rSquared = rx * rx + ry * ry + rz * rz;
+        if (target != source && b.sizeSquared <= this->theta * this->theta * rSquared) {
+            const float x = this->G / ((rSquared + softSquared) * std::sqrt(rSquared + softSquared));
+            aix = x * b.mass * rx;
+            aiy = x * b.mass * ry;
+            aiz = x * b.mass * rz;
+        } else {
+            for (unsigned j=b.first;j<b.first+b.count;j++) {
+                const float rijx = this->leafQx[j] - this->leafQx[i];
+                const float rijy = this->leafQy[j] - this->leafQy[i];
+                const float rijz = this->leafQz[j] - this->leafQz[i];
+                const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+                const float x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
+                const float aj = x * this->leafM[j];
+
+                aix += aj * rijx;
+                aiy += aj * rijy;
+                aiz += aj * rijz;
+            }
+        }
+        this->leafAx[i] += aix;
+        this->leafAy[i] += aiy;
+        this->leafAz[i] += aiz;
+    }
+}
+
+void SimulationNBodyBarnesHut::interactCells(const unsigned target, const unsigned source) {
+    // Accumulates the field of the bodies of `source` on the bodies of `target`. Two disjoint cells interact once
+    // through their centers of mass if (s_A + s_B) / d <= theta, otherwise the bigger one is opened. A cell never
+    // accepts one of its ancestors or descendants: their bodies overlap.
+    const FlatNode &a = this->flatTree[target];
+    const FlatNode &b = this->flatTree[source];
+    const bool leafA = a.next == target + 1;
+    const bool leafB = b.next == source + 1;
+
+    if (target == source) {
+        if (leafA) {
+            this->leafToLeaf(target, source);
         } else {
-            // printf("        empty\n");
+            // each unordered pair of children once, with the field of each one on the other
+            for (unsigned i=target+1;i<a.next;i=this->flatTree[i].next) {
+                this->interactCells(i, i);
+                for (unsigned j=this->flatTree[i].next;j<a.next;j=this->flatTree[j].next)
+                    this->interactMutual(i, j);
+            }
+        }
+        return;
+    }
+
+    const bool overlap = (source < target && target < b.next) || (target < source && source < a.next);
+    if (!overlap) {
+        const float dx = b.CoMx - a.CoMx;
+        const float dy = b.CoMy - a.CoMy;
+        const float dz = b.CoMz - a.CoMz;
+        const float distSquared = dx * dx + dy * dy + dz * dz;
+        const float sizeSquared = a.sizeSquared + b.sizeSquared + 2.f * std::sqrt(a.sizeSquared * b.sizeSquared);
+        if (sizeSquared <= this->theta * this->theta * distSquared) {
+            this->cellToCell(target, source);
+            return;
         }
+    }
+
+    if (leafA && leafB) {
+        this->leafToLeaf(target, source);
+    } else if (!leafA && (leafB || a.sizeSquared >= b.sizeSquared)) { // an ancestor is always the bigger cell
+        for (unsigned i=target+1;i<a.next;i=this->flatTree[i].next)
+            this->interactCells(i, source);
     } else {
-        const float rijx = tree->CoMx - body->qx; // 1 flop
-        const float rijy = tree->CoMy - body->qy; // 1 flop
-        const float rijz = tree->CoMz - body->qz; // 1 flop
+        for (unsigned j=source+1;j<b.next;j=this->flatTree[j].next)
+            this->interactCells(target, j);
+    }
+}
 
-        const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz; // 5 flops
+void SimulationNBodyBarnesHut::cellToCellMutual(const unsigned first, const unsigned second) {
+    // `cellToCell` both ways: the accelerations are opposite and the gradients equal, up to the mass of the source
+    const FlatNode &a = this->flatTree[first];
+    const FlatNode &b = this->flatTree[second];
+    LocalField &fieldA = this->localFields[first];
+    LocalField &fieldB = this->localFields[second];
+    const float rijx = b.CoMx - a.CoMx;
+    const float rijy = b.CoMy - a.CoMy;
+    const float rijz = b.CoMz - a.CoMz;
+    const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+    const float inv = 1.f / (rijSquared + this->softSquared);
+    const float g = this->G * inv * std::sqrt(inv); // G / (|| rij ||² + e²)^{3/2}
+    const float g_3 = 3.f * g * inv;
+    const float xx = g_3 * rijx * rijx - g;
+    const float xy = g_3 * rijx * rijy;
+    const float xz = g_3 * rijx * rijz;
+    const float yy = g_3 * rijy * rijy - g;
+    const float yz = g_3 * rijy * rijz;
+    const float zz = g_3 * rijz * rijz - g;
 
-        const float s = tree->size * tree->size;
+    const float gA = g * b.mass, gB = g * a.mass;
+    fieldA.ax += gA * rijx;
+    fieldA.ay += gA * rijy;
+    fieldA.az += gA * rijz;
+    fieldA.xx += b.mass * xx;
+    fieldA.xy += b.mass * xy;
+    fieldA.xz += b.mass * xz;
+    fieldA.yy += b.mass * yy;
+    fieldA.yz += b.mass * yz;
+    fieldA.zz += b.mass * zz;
 
-        if (s / rijSquared <= THETA * THETA) { // s/d < theta <=> s^2 / d^2 < theta^2, because everything is >= 0
-            // printf("        (d=%d) with group %e %e %e of mass %e\n",depth,tree->CoMx,tree->CoMy,tree->CoMz,tree->mass);
-            const float x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
-            const float ai = x * tree->mass; // 1 flops
+    fieldB.ax -= gB * rijx;
+    fieldB.ay -= gB * rijy;
+    fieldB.az -= gB * rijz;
+    fieldB.xx += a.mass * xx;
+    fieldB.xy += a.mass * xy;
+    fieldB.xz += a.mass * xz;
+    fieldB.yy += a.mass * yy;
+    fieldB.yz += a.mass * yz;
+    fieldB.zz += a.mass * zz;
+}
 
-            *ax += ai * rijx;
-            *ay += ai * rijy;
-            *az += ai * rijz;
+void SimulationNBodyBarnesHut::interactMutual(const unsigned first, const unsigned second) {
+    // `interactCells` both ways for two disjoint cells, an accepted pair is evaluated once for the two of them. Both
+    // cells descend from the same node of the self interaction, so a group of the parallel traversal only ever
+    // writes to its own fields.
+    const FlatNode &a = this->flatTree[first];
+    const FlatNode &b = this->flatTree[second];
+    const bool leafA = a.next == first + 1;
+    const bool leafB = b.next == second + 1;
 
-        } else { //We don't use this group
-            // printf("        (d=%d) we go see the childs\n",depth);        
-            for (int i=0;i<8;i++) {
-                this->computeBodyAcceleration(tree->data.internal.children[i],body,ax,ay,az,depth + 1);
+    const float dx = b.CoMx - a.CoMx;
+    const float dy = b.CoMy - a.CoMy;
+    const float dz = b.CoMz - a.CoMz;
+    const float distSquared = dx * dx + dy * dy + dz * dz;
+    const float sizeSquared = a.sizeSquared + b.sizeSquared + 2.f * std::sqrt(a.sizeSquared * b.sizeSquared);
+    if (sizeSquared <= this->theta * this->theta * distSquared) {
+        this->cellToCellMutual(first, second);
+        return;
+    }
+
+    if (leafA && leafB) {
+        // most bodies of two close leaves still accept the center of mass of the other one, see `leafToLeaf`
+        this->leafToLeaf(first, second);
+        this->leafToLeaf(second, first);
+    } else if (!leafA && (leafB || a.sizeSquared >= b.sizeSquared)) {
+        for (unsigned i=first+1;i<a.next;i=this->flatTree[i].next)
+            this->interactMutual(i, second);
+    } else {
+        for (unsigned j=second+1;j<b.next;j=this->flatTree[j].next)
+            this->interactMutual(first, j);
+    }
+}
+
+void SimulationNBodyBarnesHut::pushLocalFields(const unsigned group) {
+    // a parent precedes its children in the flat tree, so a forward sweep has always shifted its field to them already
+    const unsigned end = this->flatTree[group].next;
+    for (unsigned i=group;i<end;i++) {
+        const FlatNode &node = this->flatTree[i];
+        const LocalField &f = this->localFields[i];
+        if (node.next == i + 1) {
+            for (unsigned b=node.first;b<node.first+node.count;b++) {
+                const float dx = this->leafQx[b] - node.CoMx;
+                const float dy = this->leafQy[b] - node.CoMy;
+                const float dz = this->leafQz[b] - node.CoMz;
+                this->leafAx[b] += f.ax + f.xx * dx + f.xy * dy + f.xz * dz;
+                this->leafAy[b] += f.ay + f.xy * dx + f.yy * dy + f.yz * dz;
+                this->leafAz[b] += f.az + f.xz * dx + f.yz * dy + f.zz * dz;
+            }
+        } else {
+            for (unsigned j=i+1;j<node.next;j=this->flatTree[j].next) {
+                const FlatNode &child = this->flatTree[j];
+                LocalField &c = this->localFields[j];
+                const float dx = child.CoMx - node.CoMx;
+                const float dy = child.CoMy - node.CoMy;
+                const float dz = child.CoMz - node.CoMz;
+                c.ax += f.ax + f.xx * dx + f.xy * dy + f.xz * dz;
+                c.ay += f.ay + f.xy * dx + f.yy * dy + f.yz * dz;
+                c.az += f.az + f.xz * dx + f.yz * dy + f.zz * dz;
+                c.xx += f.xx;
+                c.xy += f.xy;
+                c.xz += f.xz;
+                c.yy += f.yy;
+                c.yz += f.yz;
+                c.zz += f.zz;
             }
         }
     }
 }
 
+void SimulationNBodyBarnesHut::splitDualTree() {
+    // a single group, the whole tree
+    this->dualTreeGroups.assign(1, 0);
+}
+
+void SimulationNBodyBarnesHut::computeDualTreeGroups(const std::vector<unsigned> &groups) {
+    for (unsigned g=0;g<groups.size();g++)
+        this->computeDualTreeGroup(groups[g]);
+}
+
+void SimulationNBodyBarnesHut::computeDualTreeGroup(const unsigned group) {
+    // all the accelerations of the bodies of the subtree `group`, the fields only live inside of it
+    const FlatNode &node = this->flatTree[group];
+    const LocalField zero = {0, 0, 0, 0, 0, 0, 0, 0, 0};
+    std::fill(this->localFields.begin() + group, this->localFields.begin() + node.next, zero);
+    std::fill(this->leafAx.begin() + node.first, this->leafAx.begin() + node.first + node.count, 0.f);
+    std::fill(this->leafAy.begin() + node.first, this->leafAy.begin() + node.first + node.count, 0.f);
+    std::fill(this->leafAz.begin() + node.first, this->leafAz.begin() + node.first + node.count, 0.f);
+    this->interactCells(group, 0);
+    this->pushLocalFields(group);
+}
+
+void SimulationNBodyBarnesHut::storeLeafAccelerations(const unsigned long begin, const unsigned long end) {
+    // back to the order of the bodies
+    for (unsigned long i=begin;i<end;i++) {
+        accAoS_t<float> &acc = this->accelerations[this->leafBodies[i]];
+        acc.ax = this->leafAx[i];
+        acc.ay = this->leafAy[i];
+        acc.az = this->leafAz[i];
+    }
+}
+
 void SimulationNBodyBarnesHut::computeBodiesAcceleration()
 {
     const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
 
     unsigned long n_bodies = this->getBodies().getN();
+    if (this->dualTree) {
+        this->localFields.resize(this->flatTree.size());
+        this->updateAllocatedBytes();
+        this->splitDualTree();
+        this->computeDualTreeGroups(this->dualTreeGroups);
+        this->storeLeafAccelerations(0, n_bodies);
+        return;
+    }
 
     for (unsigned long iBody = 0; iBody < n_bodies; iBody++) {
         // printf("Computing for %e %e %e\n",d[iBody].qx,d[iBody].qy,d[iBody].qz);
-        this->computeBodyAcceleration(this->tree,&d[iBody],&this->accelerations[iBody].ax,&this->accelerations[iBody].ay,&this->accelerations[iBody].az,0);
+        this->computeBodyAcceleration(&d[iBody],&this->accelerations[iBody].ax,&this->accelerations[iBody].ay,&this->accelerations[iBody].az);
     }
 }
 
@@ -282,7 +1111,6 @@ void SimulationNBodyBarnesHut::computeOneIteration()
 
     // printf("compute Accelerations : %f\n",time_spent);
 
-    this->freeTree(this->tree);
     // time integration
     this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
 }
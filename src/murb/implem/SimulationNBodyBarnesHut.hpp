@@ -1,58 +1,210 @@
 #ifndef SIMULATION_N_BODY_BARNES_HUT_HPP_
 #define SIMULATION_N_BODY_BARNES_HUT_HPP_
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "core/SimulationNBodyInterface.hpp"
 #include "core/Bodies.hpp"
 
 #define THETA 0.29f //0.3 doesn't pass the tests
+#define QUADRUPOLE_THETA 0.5f // opening angle when the cells carry their quadrupole moments
+#define DUAL_TREE_BUCKET_SIZE 32 // leaf size of the dual tree traversal, which prefers bigger leaves
+#define THETA_MIN 0.05f // range of opening angles searched by the tuner
+#define THETA_MAX 1.f
+#define THETA_TUNING_SAMPLES 128 // bodies whose accelerations are checked against the direct sum by the tuner
+#define THETA_TUNING_STEPS 8 // bisection steps of the tuner
+#define THETA_TUNING_PERIOD 50 // iterations between two runs of the tuner
+#define MORTON_LEVELS 21 // number of octants encoded in a 63-bit Morton key
+#define REFIT_MARGIN 0.05f // extra size of the root cell when the tree is refitted, so that the bodies can move out a bit
 
-struct Octree;
-
-struct internal_node {
-  Octree* children[8];
-};
-
-struct external_node {
-  const dataAoS_t<float>* body;
-};
-
-
+/*!
+ * \struct Octree
+ * \brief  Octree node used while building the tree.
+ *
+ * The 8 children of a node are allocated together by `OctreeArena`, so a single pointer to the first one is enough.
+ * A leaf holds a 32-bit index in `leafBodies` instead (the head of its list in `nextBody` during an insertion build).
+ */
 struct Octree {
-  bool internal; //1 for internal node, 0 for external
-  float size;
   float qx,qy,qz; //Position of the middle of the group.
+  float size;
   float CoMx,CoMy,CoMz; //Center of mass of the group
-  float mass; //Total mass of the group  
+  float mass; //Total mass of the group
+  unsigned count; //Number of bodies in the group
+  bool internal; //1 for internal node, 0 for external
   union {
-    struct internal_node internal;
-    struct external_node external;
+    Octree *children; //The 8 children of an internal node, contiguous
+    unsigned first; //First body of a leaf in `leafBodies`
   } data;
 };
 
+/*!
+ * \struct FlatNode
+ * \brief  Non-empty octree node, in the depth-first ordered array walked by the force computation.
+ *
+ * The children of a node are the nodes that follow it, up to `next`. A leaf is the only kind of node for which
+ * `next` is its own index plus one.
+ */
+struct FlatNode {
+  float CoMx,CoMy,CoMz; //Center of mass of the group
+  float mass; //Total mass of the group
+  float sizeSquared; //Squared size of the cell, for the opening criterion
+  unsigned next; //Index of the node following the subtree
+  unsigned first, count; //Bodies of the group in the depth-first ordered body arrays
+};
+
+/*!
+ * \struct Quadrupole
+ * \brief  Second moments of the masses of a flat node around its center of mass: sum of m * d_i * d_j / mass.
+ *
+ * The raw moments are kept rather than the traceless tensor, as their trace still matters with a softened kernel. They
+ * are divided by the mass of the node, otherwise they would overflow a float with masses of astronomical scale.
+ */
+struct Quadrupole {
+  float xx,xy,xz,yy,yz,zz;
+};
 
-class SimulationNBodyBarnesHut : public SimulationNBodyInterface {
+/*!
+ * \struct LocalField
+ * \brief  Acceleration at the center of mass of a flat node and its gradient, for the dual tree traversal.
+ *
+ * The acceleration at a point x of the node is (ax, ay, az) + J.(x - CoM), with J the symmetric tidal tensor.
+ */
+struct LocalField {
+  float ax,ay,az;
+  float xx,xy,xz,yy,yz,zz;
+};
+
+/*!
+ * \class  OctreeArena
+ * \brief  Bump allocator for the octree nodes.
+ *
+ * Nodes are handed out from big chunks that are kept from one iteration to the next: building a tree never calls
+ * `malloc` once the arena is warm and `reset` rewinds the whole tree in O(1). A request never spans two chunks, so
+ * the 8 children of a node are always contiguous in memory. Chunks are only reserved on first use.
+ */
+class OctreeArena {
+  protected:
+    std::vector<std::unique_ptr<Octree[]>> chunks; /*!< Reserved node storage. */
+    unsigned long chunkSize;                        /*!< Number of nodes per chunk. */
+    unsigned long chunk;                            /*!< Index of the chunk currently filled. */
+    unsigned long offset;                           /*!< Index of the first free node in the current chunk. */
+
+  public:
+    OctreeArena(const unsigned long chunkSize);
+    Octree *allocate(const unsigned long count);
+    void reset();
+    unsigned long getReservedBytes() const;
+};
+
+class SimulationNBodyBarnesHut : public SimulationNBodyInterface<float> {
   protected:
     std::vector<accAoS_t<float>> accelerations; /*!< Array of body acceleration structures. */
     Octree *tree;
+    OctreeArena arena;        /*!< Storage of the octree nodes, reused by every iteration. */
+    unsigned long nodeBytes;  /*!< Bytes reserved for the nodes so far (already counted in `allocatedBytes`). */
+    std::vector<FlatNode> flatTree; /*!< Non-empty nodes of the tree in depth-first order. */
     float softSquared;
 
+    unsigned bucketSize;                   /*!< Maximum number of bodies in a leaf (unless they share a cell of the
+                                                deepest level). */
+    std::vector<unsigned> leafBodies;      /*!< Bodies grouped by leaf, in depth-first order. */
+    std::vector<unsigned> nextBody;        /*!< Linked lists of the bodies of each leaf during an insertion build. */
+    std::vector<float> leafQx;             /*!< Positions and masses of the bodies in the `leafBodies` order. */
+    std::vector<float> leafQy;
+    std::vector<float> leafQz;
+    std::vector<float> leafM;
+
+    float refitTolerance;                  /*!< Growth of the node count tolerated by the refit before a rebuild (0 to
+                                                rebuild every iteration). */
+    unsigned rebuildNodes;                 /*!< Number of nodes of the last rebuilt tree (0 if a rebuild is due). */
+    unsigned long treeOrder;               /*!< Reordering of the bodies the tree indexes (see `Bodies::reorder`). */
+    std::vector<unsigned> escapedBodies;   /*!< Bodies that left the cell of their leaf since the last iteration. */
+
+    bool quadrupole;                       /*!< Add the quadrupole moments of the accepted cells to the accelerations. */
+    std::vector<Quadrupole> quadrupoles;   /*!< Quadrupole moments of each flat node (if `quadrupole` is set). */
+
+    bool dualTree;                         /*!< Walk the tree once per pair of cells instead of once per body (with the
+                                                monopoles only). */
+    std::vector<LocalField> localFields;   /*!< Field of the accepted cells at each flat node (dual tree traversal). */
+    std::vector<unsigned> dualTreeGroups;  /*!< Flat subtrees computed independently by the dual tree traversal, in the
+                                                tree order. */
+    std::vector<float> leafAx;             /*!< Accelerations of the bodies, in the `leafBodies` order. */
+    std::vector<float> leafAy;
+    std::vector<float> leafAz;
+
+    float theta;                           /*!< Opening angle of the walk. */
+    float thetaTarget;                     /*!< Relative acceleration error targeted by the tuner of `theta` (0 to
+                                                keep `theta` as it is). */
+    unsigned tuningCountdown;              /*!< Iterations left before the next run of the tuner. */
+    std::vector<unsigned> tuningBodies;    /*!< Bodies sampled by the tuner, as positions in `leafBodies`. */
+    std::vector<unsigned> tuningGroups;    /*!< Groups of the dual tree traversal that hold a sampled body. */
+    std::vector<float> tuningAx;           /*!< Direct sum accelerations of the sampled bodies. */
+    std::vector<float> tuningAy;
+    std::vector<float> tuningAz;
+
+    bool mortonBuild;                      /*!< Build the tree from the sorted Morton keys instead of by insertion. */
+    std::vector<uint64_t> mortonKeys;      /*!< Morton key of each body (sorted after `sortMortonKeys`). */
+    std::vector<uint64_t> mortonKeysTmp;   /*!< Radix sort buffer. */
+    std::vector<unsigned> mortonOrder;     /*!< Body index of each key. */
+    std::vector<unsigned> mortonOrderTmp;  /*!< Radix sort buffer. */
+    std::vector<unsigned long> radixCount; /*!< Radix sort histograms. */
+
   public:
     SimulationNBodyBarnesHut(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
                          const unsigned long randInit = 0);
     virtual ~SimulationNBodyBarnesHut() = default;
     virtual void computeOneIteration();
+    void setMortonBuild(const bool mortonBuild);
+    void setBucketSize(const unsigned bucketSize);
+    void setRefitTolerance(const float refitTolerance);
+    virtual bool setQuadrupole(const bool quadrupole);
+    bool setDualTree(const bool dualTree);
+    void setTheta(const float theta);
+    void setThetaTarget(const float thetaTarget);
+    float getTheta() const;
 
   protected:
     void initIteration();
     virtual void computeBodiesAcceleration();
     void getBoundingBox(float*,float*,float*,float*,float*,float*);
-    void insertBody(Octree* tree, const dataAoS_t<float> *body);
-    void updateTree(Octree* tree);
-    void computeOctree();
-    void freeTree(Octree *tree);
-    void computeBodyAcceleration(Octree *tree,const dataAoS_t<float> *body,float *ax, float *ay, float *az, int depth);
+    void initRoot(OctreeArena &arena);
+    void splitNode(OctreeArena &arena, Octree* tree);
+    void setLeafBodies(Octree* leaf, const unsigned first, const unsigned count);
+    void insertBody(OctreeArena &arena, Octree* tree, int level, const unsigned body);
+    unsigned packLeaves(Octree* tree, unsigned offset);
+    void packBodies(const unsigned long begin, const unsigned long end);
+    void computeMortonKeys(const unsigned long begin, const unsigned long end);
+    void sortMortonKeys();
+    void buildMortonTree(OctreeArena &arena, Octree *node, const int level, const unsigned long begin,
+                         const unsigned long end);
+    unsigned updateTree(Octree* tree);
+    void setCenterOfMass(Octree* tree, const float CoMx, const float CoMy, const float CoMz, const float mass);
+    unsigned flattenTree(const Octree* tree, unsigned index);
+    bool refitOctree();
+    void refitLeaves(Octree* tree, const float *lo, const float *hi);
+    virtual void computeOctree();
+    virtual void computeQuadrupoles();
+    void computeLeafQuadrupole(const unsigned index);
+    void computeInternalQuadrupole(const unsigned index);
+    void tuneTheta();
+    void computeTuningReference();
+    float computeTuningError(const float theta);
+    virtual unsigned long getNodeBytes() const;
+    void updateAllocatedBytes();
+    unsigned computeBodyAcceleration(const dataAoS_t<float> *body,float *ax, float *ay, float *az);
+    virtual void splitDualTree();
+    virtual void computeDualTreeGroups(const std::vector<unsigned> &groups);
+    void computeDualTreeGroup(const unsigned group);
+    void interactCells(const unsigned target, const unsigned source);
+    void cellToCell(const unsigned target, const unsigned source);
+    void interactMutual(const unsigned first, const unsigned second);
+    void cellToCellMutual(const unsigned first, const unsigned second);
+    void leafToLeaf(const unsigned target, const unsigned source);
+    void pushLocalFields(const unsigned group);
+    void storeLeafAccelerations(const unsigned long begin, const unsigned long end);
 
 };
 
@@ -1,31 +1,396 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <string>
+#include <omp.h>
 
 #include "SimulationNBodyBarnesHut.hpp"
 #include "SimulationNBodyBarnesHutOMP.hpp"
 
+// same digits as the sequential radix sort
+constexpr int RADIX_BITS = 11;
+constexpr int RADIX_PASSES = 6;
+constexpr unsigned RADIX_SIZE = 1 << RADIX_BITS;
+
 SimulationNBodyBarnesHutOMP::SimulationNBodyBarnesHutOMP(const unsigned long nBodies, const std::string &scheme, const float soft,
                                            const unsigned long randInit)
     : SimulationNBodyBarnesHut(nBodies, scheme, soft, randInit)
 {
+    // the top levels are small, the bulk of the nodes goes to the subtree arenas
+    this->arena = OctreeArena(8 * (PARALLEL_SUBTREES + 1));
+    for (int s=0;s<PARALLEL_SUBTREES;s++)
+        this->subtreeArenas.emplace_back(4 * nBodies / PARALLEL_SUBTREES + 8);
+    this->subtreeOf.resize(nBodies);
+    this->subtreeBodies.resize(nBodies);
+    this->threadCount.resize((unsigned long)omp_get_max_threads() * RADIX_SIZE);
+    this->bodyCost.resize(nBodies, 1);
+    this->bodyCostTmp.resize(nBodies);
+    this->costOrder = 0;
+    this->allocatedBytes += 2 * nBodies * sizeof(unsigned);
 }
 
+unsigned long SimulationNBodyBarnesHutOMP::getNodeBytes() const
+{
+    unsigned long bytes = SimulationNBodyBarnesHut::getNodeBytes();
+    for (auto &a : this->subtreeArenas)
+        bytes += a.getReservedBytes();
+    return bytes;
+}
 
-void SimulationNBodyBarnesHutOMP::computeBodiesAcceleration()
+// Counting sort of the bodies by subtree, the threads keep the original order inside each subtree.
+void SimulationNBodyBarnesHutOMP::partitionBodies()
 {
     const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+    const unsigned long n_bodies = this->getBodies().getN();
+    const Octree *root = this->tree;
+
+    #pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        const int n_threads = omp_get_num_threads();
+        const unsigned long begin = n_bodies * t / n_threads;
+        const unsigned long end = n_bodies * (t + 1) / n_threads;
+        unsigned long *count = &this->threadCount[t * RADIX_SIZE];
+        std::fill(count, count + PARALLEL_SUBTREES, 0);
+
+        // the centers of the level 1 nodes are computed exactly like in `splitNode`
+        const float size_increment = root->size / 2 / 2;
+        for (unsigned long i=begin;i<end;i++) {
+            const int o1 = (d[i].qx > root->qx) * 1 + (d[i].qy > root->qy) * 2 + (d[i].qz > root->qz) * 4;
+            const float cx = (o1 & 1) ? root->qx + size_increment : root->qx - size_increment;
+            const float cy = (o1 & 2) ? root->qy + size_increment : root->qy - size_increment;
+            const float cz = (o1 & 4) ? root->qz + size_increment : root->qz - size_increment;
+            const int o2 = (d[i].qx > cx) * 1 + (d[i].qy > cy) * 2 + (d[i].qz > cz) * 4;
+            this->subtreeOf[i] = o1 * 8 + o2;
+            count[o1 * 8 + o2]++;
+        }
+        #pragma omp barrier
+        #pragma omp single
+        {
+            unsigned long offset = 0;
+            for (int s=0;s<PARALLEL_SUBTREES;s++) {
+                this->subtreeStart[s] = offset;
+                for (int u=0;u<n_threads;u++) {
+                    const unsigned long tmp = this->threadCount[u * RADIX_SIZE + s];
+                    this->threadCount[u * RADIX_SIZE + s] = offset;
+                    offset += tmp;
+                }
+            }
+            this->subtreeStart[PARALLEL_SUBTREES] = offset;
+        }
+        for (unsigned long i=begin;i<end;i++)
+            this->subtreeBodies[count[this->subtreeOf[i]]++] = i;
+    }
+}
+
+void SimulationNBodyBarnesHutOMP::sortMortonKeysParallel()
+{
+    const unsigned long n_bodies = this->getBodies().getN();
 
-    unsigned long n_bodies = this->getBodies().getN();
     #pragma omp parallel
     {
-        #pragma omp for
-        for (unsigned long iBody = 0; iBody < n_bodies; iBody++) {
-            // printf("Computing for %e %e %e\n",d[iBody].qx,d[iBody].qy,d[iBody].qz);
-            this->computeBodyAcceleration(this->tree,&d[iBody],&this->accelerations[iBody].ax,&this->accelerations[iBody].ay,&this->accelerations[iBody].az,0);
+        const int t = omp_get_thread_num();
+        const int n_threads = omp_get_num_threads();
+        const unsigned long begin = n_bodies * t / n_threads;
+        const unsigned long end = n_bodies * (t + 1) / n_threads;
+        unsigned long *count = &this->threadCount[t * RADIX_SIZE];
+
+        this->computeMortonKeys(begin, end);
+
+        for (int p=0;p<RADIX_PASSES;p++) {
+            const int shift = p * RADIX_BITS;
+            std::fill(count, count + RADIX_SIZE, 0);
+            #pragma omp barrier
+            for (unsigned long i=begin;i<end;i++)
+                count[(this->mortonKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+            #pragma omp barrier
+            #pragma omp single
+            {
+                // offsets in (digit, thread) order so that the sort stays stable
+                unsigned long offset = 0;
+                for (unsigned b=0;b<RADIX_SIZE;b++)
+                    for (int u=0;u<n_threads;u++) {
+                        const unsigned long tmp = this->threadCount[u * RADIX_SIZE + b];
+                        this->threadCount[u * RADIX_SIZE + b] = offset;
+                        offset += tmp;
+                    }
+            }
+            // a pass where all the keys share the same digit does not move anything, but is cheap enough in parallel
+            for (unsigned long i=begin;i<end;i++) {
+                const unsigned long dst = count[(this->mortonKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+                this->mortonKeysTmp[dst] = this->mortonKeys[i];
+                this->mortonOrderTmp[dst] = this->mortonOrder[i];
+            }
+            #pragma omp barrier
+            #pragma omp single
+            {
+                std::swap(this->mortonKeys, this->mortonKeysTmp);
+                std::swap(this->mortonOrder, this->mortonOrderTmp);
+            }
+        }
+    }
+
+    // the subtrees are contiguous ranges of the sorted keys
+    const std::vector<uint64_t> &keys = this->mortonKeys;
+    unsigned long i = 0;
+    for (int s=0;s<PARALLEL_SUBTREES;s++) {
+        this->subtreeStart[s] = i;
+        while (i < n_bodies && (int)(keys[i] >> (3 * (MORTON_LEVELS - PARALLEL_LEVELS))) == s)
+            i++;
+    }
+    this->subtreeStart[PARALLEL_SUBTREES] = n_bodies;
+}
+
+void SimulationNBodyBarnesHutOMP::computeOctree()
+{
+    const unsigned long n_bodies = this->getBodies().getN();
+    if (n_bodies <= this->bucketSize) {
+        SimulationNBodyBarnesHut::computeOctree();
+        return;
+    }
+    if (this->refitOctree()) // the refit is sequential, it is much cheaper than the parallel build
+        return;
+
+    this->arena.reset();
+    this->initRoot(this->arena);
+
+    if (this->mortonBuild)
+        this->sortMortonKeysParallel();
+    else
+        this->partitionBodies();
+
+    // the top levels are built sequentially: a node is internal iff it holds more than `bucketSize` bodies
+    this->splitNode(this->arena, this->tree);
+    for (int o1=0;o1<8;o1++) {
+        const unsigned long begin = this->subtreeStart[o1 * 8];
+        const unsigned long end = this->subtreeStart[(o1 + 1) * 8];
+        if (end - begin > this->bucketSize) {
+            this->splitNode(this->arena, &this->tree->data.children[o1]);
+        } else {
+            this->setLeafBodies(&this->tree->data.children[o1], begin, end - begin);
+            if (!this->mortonBuild) { // same order as the sequential insertion, not grouped by level 2 octant
+                std::copy(&this->subtreeBodies[begin], &this->subtreeBodies[end], &this->leafBodies[begin]);
+                std::sort(&this->leafBodies[begin], &this->leafBodies[end]);
+            }
+        }
+    }
+
+    // then each subtree is built independently, with the bodies in the same order as the sequential build
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s=0;s<PARALLEL_SUBTREES;s++) {
+        const unsigned long begin = this->subtreeStart[s];
+        const unsigned long end = this->subtreeStart[s + 1];
+        OctreeArena &arena = this->subtreeArenas[s];
+        arena.reset();
+        if (begin == end)
+            continue;
+
+        Octree *parent = &this->tree->data.children[s / 8];
+        if (parent->internal == false) // part of the bodies of a level 1 leaf
+            continue;
+
+        Octree *node = &parent->data.children[s % 8];
+        if (this->mortonBuild) {
+            this->buildMortonTree(arena, node, PARALLEL_LEVELS, begin, end);
+        } else {
+            for (unsigned long i=begin;i<end;i++)
+                this->insertBody(arena, node, PARALLEL_LEVELS, this->subtreeBodies[i]);
+            this->packLeaves(node, begin);
+        }
+    }
+    if (this->mortonBuild)
+        this->leafBodies.swap(this->mortonOrder);
+
+    #pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        const int n_threads = omp_get_num_threads();
+        this->packBodies(n_bodies * t / n_threads, n_bodies * (t + 1) / n_threads);
+    }
+
+    unsigned n_nodes;
+    #pragma omp parallel
+    #pragma omp single
+    n_nodes = this->updateTreeParallel(this->tree, 0, 0);
+
+    // the top levels are flattened sequentially, which gives the offset of each subtree in the flat tree
+    this->flatTree.resize(n_nodes);
+    for (int s=0;s<PARALLEL_SUBTREES;s++)
+        this->subtreeRoot[s] = NULL;
+    this->flattenTop(this->tree, 0, 0, 0);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int s=0;s<PARALLEL_SUBTREES;s++)
+        if (this->subtreeRoot[s] != NULL)
+            this->flattenTree(this->subtreeRoot[s], this->subtreeFlatIndex[s]);
+
+    this->updateAllocatedBytes();
+    this->rebuildNodes = n_nodes;
+}
+
+// Same computation as `updateTree`, the children of the top levels are processed by concurrent tasks.
+unsigned SimulationNBodyBarnesHutOMP::updateTreeParallel(Octree* tree, const int level, const int subtree)
+{
+    if (level >= PARALLEL_LEVELS) {
+        this->subtreeFlatCount[subtree] = this->updateTree(tree);
+        return this->subtreeFlatCount[subtree];
+    }
+    if (tree->internal == false)
+        return this->updateTree(tree);
+
+    unsigned counts[8];
+    for (int i=0;i<8;i++) {
+        Octree *child = &tree->data.children[i];
+        #pragma omp task firstprivate(child, i) shared(counts)
+        counts[i] = this->updateTreeParallel(child, level + 1, subtree * 8 + i);
+    }
+    #pragma omp taskwait
+
+    float CoMx = 0,CoMy=0, CoMz=0, mass = 0;
+    unsigned count = 1;
+    tree->count = 0;
+    for (int i=0;i<8;i++) {
+        count += counts[i];
+        tree->count += tree->data.children[i].count;
+        float child_mass = tree->data.children[i].mass;
+        CoMx += tree->data.children[i].CoMx * child_mass;
+        CoMy += tree->data.children[i].CoMy * child_mass;
+        CoMz += tree->data.children[i].CoMz * child_mass;
+        mass += child_mass;
+    }
+
+    this->setCenterOfMass(tree, CoMx, CoMy, CoMz, mass);
+    return tree->count != 0 ? count : 0;
+}
+
+// Same as `flattenTree` for the top levels, the subtrees are only given their position and filled concurrently later.
+unsigned SimulationNBodyBarnesHutOMP::flattenTop(const Octree* tree, const int level, const int subtree, unsigned index)
+{
+    if (level >= PARALLEL_LEVELS) {
+        this->subtreeRoot[subtree] = tree;
+        this->subtreeFlatIndex[subtree] = index;
+        return index + this->subtreeFlatCount[subtree];
+    }
+    if (tree->count == 0 || tree->internal == false)
+        return this->flattenTree(tree, index);
+
+    FlatNode &node = this->flatTree[index];
+    node.CoMx = tree->CoMx;
+    node.CoMy = tree->CoMy;
+    node.CoMz = tree->CoMz;
+    node.mass = tree->mass;
+    node.sizeSquared = tree->size * tree->size;
+    node.count = tree->count;
+    // the subtrees below may not be flattened yet, but their bodies are known to start with the first subtree
+    node.first = this->subtreeStart[subtree << (3 * (PARALLEL_LEVELS - level))];
+
+    unsigned next = index + 1;
+    for (int i=0;i<8;i++)
+        next = this->flattenTop(&tree->data.children[i], level + 1, subtree * 8 + i, next);
+    node.next = next;
+    return next;
+}
+
+
+void SimulationNBodyBarnesHutOMP::computeQuadrupoles()
+{
+    // the leaves hold all the bodies and are independent, the few internal nodes are then swept backward
+    const unsigned n_nodes = this->flatTree.size();
+    this->quadrupoles.resize(n_nodes);
+    #pragma omp parallel for schedule(dynamic, 256)
+    for (unsigned i=0;i<n_nodes;i++)
+        if (this->flatTree[i].next == i + 1)
+            this->computeLeafQuadrupole(i);
+    for (unsigned i=n_nodes;i-->0;)
+        if (this->flatTree[i].next != i + 1)
+            this->computeInternalQuadrupole(i);
+    this->updateAllocatedBytes();
+}
+
+void SimulationNBodyBarnesHutOMP::splitDualTree()
+{
+    // the biggest subtrees with at most `limit` bodies are walked concurrently against the whole tree
+    const unsigned long limit = std::max(this->getBodies().getN() / (omp_get_max_threads() * DUAL_TREE_GROUPS), 1ul);
+    this->dualTreeGroups.clear();
+    const unsigned n_nodes = this->flatTree.size();
+    unsigned i = 0;
+    while (i < n_nodes) {
+        if (this->flatTree[i].count <= limit || this->flatTree[i].next == i + 1) {
+            this->dualTreeGroups.push_back(i);
+            i = this->flatTree[i].next;
+        } else {
+            i++;
         }
     }
 }
+
+void SimulationNBodyBarnesHutOMP::computeDualTreeGroups(const std::vector<unsigned> &groups)
+{
+    const unsigned n_groups = groups.size();
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (unsigned g = 0; g < n_groups; g++)
+        this->computeDualTreeGroup(groups[g]);
+}
+
+void SimulationNBodyBarnesHutOMP::computeBodiesAcceleration()
+{
+    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+
+    unsigned long n_bodies = this->getBodies().getN();
+    if (this->dualTree) {
+        this->localFields.resize(this->flatTree.size());
+        this->updateAllocatedBytes();
+        this->splitDualTree();
+        this->computeDualTreeGroups(this->dualTreeGroups);
+        #pragma omp parallel
+        {
+            const int t = omp_get_thread_num();
+            const int n_threads = omp_get_num_threads();
+            this->storeLeafAccelerations(n_bodies * t / n_threads, n_bodies * (t + 1) / n_threads);
+        }
+        return;
+    }
+
+    // each thread walks for a contiguous range of the tree order, which costed the same at the previous iteration
+    const unsigned n_zones = omp_get_max_threads();
+    this->computeCostZones(n_zones);
+    #pragma omp parallel for schedule(static, 1)
+    for (unsigned z = 0; z < n_zones; z++) {
+        for (unsigned long i = this->zoneStart[z]; i < this->zoneStart[z + 1]; i++) {
+            const unsigned iBody = this->leafBodies[i];
+            this->bodyCost[iBody] = this->computeBodyAcceleration(&d[iBody], &this->accelerations[iBody].ax,
+                                                                  &this->accelerations[iBody].ay,
+                                                                  &this->accelerations[iBody].az);
+        }
+    }
+}
+
+void SimulationNBodyBarnesHutOMP::computeCostZones(const unsigned n_zones)
+{
+    // cuts the depth-first order of the bodies into `n_zones` ranges of about the same total cost
+    const unsigned long n_bodies = this->getBodies().getN();
+    if (this->costOrder != this->getBodies().getReorderCount()) {
+        // the bodies moved in memory since the costs were measured
+        const std::vector<unsigned long> &perm = this->getBodies().getPermutation();
+        for (unsigned long i = 0; i < n_bodies; i++)
+            this->bodyCostTmp[i] = this->bodyCost[perm[i]];
+        this->bodyCost.swap(this->bodyCostTmp);
+        this->costOrder = this->getBodies().getReorderCount();
+    }
+    unsigned long total = 0;
+    for (unsigned long i = 0; i < n_bodies; i++)
+        total += this->bodyCost[this->leafBodies[i]];
+
+    this->zoneStart.resize(n_zones + 1);
+    unsigned long sum = 0;
+    unsigned z = 0;
+    for (unsigned long i = 0; i < n_bodies; i++) {
+        while (z < n_zones && sum * n_zones >= total * z)
+            this->zoneStart[z++] = i;
+        sum += this->bodyCost[this->leafBodies[i]];
+    }
+    while (z <= n_zones)
+        this->zoneStart[z++] = n_bodies;
+}
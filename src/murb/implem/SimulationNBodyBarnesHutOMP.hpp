@@ -7,9 +7,24 @@
 #include "SimulationNBodyBarnesHut.hpp"
 #include "core/Bodies.hpp"
 
+#define PARALLEL_LEVELS 2                         // depth of the subtrees built by independent tasks
+#define PARALLEL_SUBTREES (1 << (3 * PARALLEL_LEVELS)) // number of such subtrees
+#define DUAL_TREE_GROUPS 16                       // subtrees per thread walked independently by the dual tree traversal
 
 class SimulationNBodyBarnesHutOMP : public SimulationNBodyBarnesHut {
-
+  protected:
+    std::vector<OctreeArena> subtreeArenas;    /*!< One arena per subtree so that they can be built concurrently. */
+    std::vector<unsigned> subtreeOf;           /*!< Subtree of each body (insertion build). */
+    std::vector<unsigned> subtreeBodies;       /*!< Bodies sorted by subtree, in their original order. */
+    unsigned long subtreeStart[PARALLEL_SUBTREES + 1]; /*!< First body of each subtree in the sorted bodies. */
+    std::vector<unsigned long> threadCount;    /*!< Per-thread histograms of the parallel counting sorts. */
+    unsigned subtreeFlatCount[PARALLEL_SUBTREES];      /*!< Number of non-empty nodes of each subtree. */
+    unsigned subtreeFlatIndex[PARALLEL_SUBTREES];      /*!< Position of each subtree in the flat tree. */
+    const Octree *subtreeRoot[PARALLEL_SUBTREES];      /*!< Root of each subtree (NULL if it does not exist). */
+    std::vector<unsigned> bodyCost;            /*!< Cost of the walk of each body at the previous iteration. */
+    std::vector<unsigned> bodyCostTmp;
+    unsigned long costOrder;                   /*!< Reordering of the bodies `bodyCost` is indexed by. */
+    std::vector<unsigned long> zoneStart;      /*!< First position in `leafBodies` of the cost zone of each thread. */
 
   public:
     SimulationNBodyBarnesHutOMP(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
@@ -18,6 +33,16 @@ class SimulationNBodyBarnesHutOMP : public SimulationNBodyBarnesHut {
 
   protected:
     void computeBodiesAcceleration() override;
+    void computeCostZones(const unsigned n_zones);
+    void computeOctree() override;
+    void computeQuadrupoles() override;
+    void splitDualTree() override;
+    void computeDualTreeGroups(const std::vector<unsigned> &groups) override;
+    unsigned long getNodeBytes() const override;
+    void partitionBodies();
+    void sortMortonKeysParallel();
+    unsigned updateTreeParallel(Octree* tree, const int level, const int subtree);
+    unsigned flattenTop(const Octree* tree, const int level, const int subtree, unsigned index);
 
 };
 
@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "mipp.h"
+
+#include "SimulationNBodySIMDKernel.hpp"
+#include "SimulationNBodyBarnesHutSIMD.hpp"
+
+// same expansion as in `computeBodyAcceleration`, `cell` holds the position, the mass and the moments of the cell
+static inline void accumulateQuadrupoleSIMD(const mipp::Reg<float> &i_qx, const mipp::Reg<float> &i_qy,
+                                            const mipp::Reg<float> &i_qz, const float *cell,
+                                            const mipp::Reg<float> &softSquared_v, const mipp::Reg<float> &G_v,
+                                            mipp::Reg<float> &ax, mipp::Reg<float> &ay, mipp::Reg<float> &az)
+{
+    const mipp::Reg<float> rijx = mipp::Reg<float>(cell[0]) - i_qx;
+    const mipp::Reg<float> rijy = mipp::Reg<float>(cell[1]) - i_qy;
+    const mipp::Reg<float> rijz = mipp::Reg<float>(cell[2]) - i_qz;
+    const mipp::Reg<float> s = rijx * rijx + rijy * rijy + rijz * rijz + softSquared_v;
+    const mipp::Reg<float> inv = mipp::Reg<float>(1.f) / s;
+    const mipp::Reg<float> ai = G_v * mipp::Reg<float>(cell[3]) / (s * mipp::sqrt(s));
+
+    const mipp::Reg<float> xx = cell[4], xy = cell[5], xz = cell[6], yy = cell[7], yz = cell[8], zz = cell[9];
+    const mipp::Reg<float> sx = (xx * rijx + xy * rijy + xz * rijz) * inv;
+    const mipp::Reg<float> sy = (xy * rijx + yy * rijy + yz * rijz) * inv;
+    const mipp::Reg<float> sz = (xz * rijx + yz * rijy + zz * rijz) * inv;
+    const mipp::Reg<float> rSr = (rijx * sx + rijy * sy + rijz * sz) * inv;
+    const mipp::Reg<float> ai_3 = mipp::Reg<float>(3.f) * ai;
+    const mipp::Reg<float> aq = ai * (mipp::Reg<float>(1.f) + mipp::Reg<float>(7.5f) * rSr -
+                                      mipp::Reg<float>(1.5f * (cell[4] + cell[7] + cell[9])) * inv);
+
+    ax += aq * rijx - ai_3 * sx;
+    ay += aq * rijy - ai_3 * sy;
+    az += aq * rijz - ai_3 * sz;
+}
+
+SimulationNBodyBarnesHutSIMD::SimulationNBodyBarnesHutSIMD(const unsigned long nBodies, const std::string &scheme,
+                                                           const float soft, const unsigned long randInit)
+    : SimulationNBodyBarnesHut(nBodies, scheme, soft, randInit)
+{
+    // the last register of the last group reads up to N-1 bodies past the end
+    const unsigned long n = this->getBodies().getN() + mipp::N<float>();
+    this->leafQx.resize(n);
+    this->leafQy.resize(n);
+    this->leafQz.resize(n);
+    this->allocatedBytes += 3 * mipp::N<float>() * sizeof(float);
+}
+
+void SimulationNBodyBarnesHutSIMD::computeGroupAcceleration(const unsigned first, const unsigned last) {
+    // computes the accelerations of the bodies [first, last) of the depth-first order
+    constexpr int N = mipp::N<float>();
+    float min_x = this->leafQx[first], max_x = min_x;
+    float min_y = this->leafQy[first], max_y = min_y;
+    float min_z = this->leafQz[first], max_z = min_z;
+    for (unsigned b=first+1;b<last;b++) {
+        min_x = std::min(min_x, this->leafQx[b]);
+        max_x = std::max(max_x, this->leafQx[b]);
+        min_y = std::min(min_y, this->leafQy[b]);
+        max_y = std::max(max_y, this->leafQy[b]);
+        min_z = std::min(min_z, this->leafQz[b]);
+        max_z = std::max(max_z, this->leafQz[b]);
+    }
+
+    // Same walk as `computeBodyAcceleration`, with the distance from the node to the closest point of the group: a
+    // node is only accepted if it would be for every body of the group.
+    this->listQx.clear();
+    this->listQy.clear();
+    this->listQz.clear();
+    this->listM.clear();
+    this->listCells.clear();
+    const FlatNode *nodes = this->flatTree.data();
+    const unsigned n_nodes = this->flatTree.size();
+    const float theta = this->theta;
+    unsigned i = 0;
+    while (i < n_nodes) {
+        const FlatNode &node = nodes[i];
+        const float dx = std::max(std::max(min_x - node.CoMx, node.CoMx - max_x), 0.f);
+        const float dy = std::max(std::max(min_y - node.CoMy, node.CoMy - max_y), 0.f);
+        const float dz = std::max(std::max(min_z - node.CoMz, node.CoMz - max_z), 0.f);
+        const float distSquared = dx * dx + dy * dy + dz * dz;
+
+        if (node.sizeSquared / distSquared <= theta * theta && this->quadrupole) {
+            const Quadrupole &q = this->quadrupoles[i];
+            const float cell[10] = {node.CoMx, node.CoMy, node.CoMz, node.mass, q.xx, q.xy, q.xz, q.yy, q.yz, q.zz};
+            this->listCells.insert(this->listCells.end(), cell, cell + 10);
+            i = node.next;
+        } else if (node.sizeSquared / distSquared <= theta * theta) {
+            this->listQx.push_back(node.CoMx);
+            this->listQy.push_back(node.CoMy);
+            this->listQz.push_back(node.CoMz);
+            this->listM.push_back(node.mass);
+            i = node.next;
+        } else if (node.next == i + 1) {
+            this->listQx.insert(this->listQx.end(), &this->leafQx[node.first], &this->leafQx[node.first + node.count]);
+            this->listQy.insert(this->listQy.end(), &this->leafQy[node.first], &this->leafQy[node.first + node.count]);
+            this->listQz.insert(this->listQz.end(), &this->leafQz[node.first], &this->leafQz[node.first + node.count]);
+            this->listM.insert(this->listM.end(), &this->leafM[node.first], &this->leafM[node.first + node.count]);
+            i = node.next;
+        } else {
+            i++;
+        }
+    }
+
+    const mipp::Reg<float> softSquared_v = this->softSquared;
+    const mipp::Reg<float> G_v = this->G;
+    const unsigned n_list = this->listM.size();
+    const unsigned n_cells = this->listCells.size();
+    for (unsigned b=first;b<last;b+=N) {
+        mipp::Reg<float> i_qx, i_qy, i_qz;
+        i_qx.loadu(&this->leafQx[b]);
+        i_qy.loadu(&this->leafQy[b]);
+        i_qz.loadu(&this->leafQz[b]);
+
+        mipp::Reg<float> ax = 0.0;
+        mipp::Reg<float> ay = 0.0;
+        mipp::Reg<float> az = 0.0;
+        for (unsigned j=0;j<n_list;j++)
+            accumulateAccelerationSIMD(i_qx, i_qy, i_qz, this->listQx[j], this->listQy[j], this->listQz[j],
+                                       this->listM[j], softSquared_v, G_v, ax, ay, az);
+        for (unsigned j=0;j<n_cells;j+=10)
+            accumulateQuadrupoleSIMD(i_qx, i_qy, i_qz, &this->listCells[j], softSquared_v, G_v, ax, ay, az);
+
+        // the lanes past `last` belong to the next group (or to the padding) and are dropped
+        float tabx[N], taby[N], tabz[N];
+        ax.storeu(tabx);
+        ay.storeu(taby);
+        az.storeu(tabz);
+        for (unsigned k=0;k<N && b+k<last;k++) {
+            accAoS_t<float> &acc = this->accelerations[this->leafBodies[b + k]];
+            acc.ax = tabx[k];
+            acc.ay = taby[k];
+            acc.az = tabz[k];
+        }
+    }
+}
+
+void SimulationNBodyBarnesHutSIMD::computeBodiesAcceleration()
+{
+    // the groups are the biggest subtrees with at most GROUP_SIZE bodies
+    const FlatNode *nodes = this->flatTree.data();
+    const unsigned n_nodes = this->flatTree.size();
+    unsigned i = 0;
+    while (i < n_nodes) {
+        if (nodes[i].count <= GROUP_SIZE || nodes[i].next == i + 1) {
+            this->computeGroupAcceleration(nodes[i].first, nodes[i].first + nodes[i].count);
+            i = nodes[i].next;
+        } else {
+            i++;
+        }
+    }
+}
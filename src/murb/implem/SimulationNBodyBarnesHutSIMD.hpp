@@ -0,0 +1,44 @@
+#ifndef SIMULATION_N_BODY_BARNES_HUT_SIMD_HPP_
+#define SIMULATION_N_BODY_BARNES_HUT_SIMD_HPP_
+
+#include <string>
+#include <vector>
+
+#include "mipp.h"
+
+#include "core/SimulationNBodyInterface.hpp"
+#include "SimulationNBodyBarnesHut.hpp"
+#include "core/Bodies.hpp"
+
+#define GROUP_SIZE 32 // maximum number of bodies sharing an interaction list
+
+/*!
+ * \class  SimulationNBodyBarnesHutSIMD
+ * \brief  Barnes-Hut walking the tree once per group of close bodies.
+ *
+ * A group is the biggest subtree holding at most GROUP_SIZE bodies (or a bigger leaf). The tree is walked once for the
+ * whole group with the opening criterion evaluated at the distance to the bounding box of the group, which builds a
+ * list of cells and bodies accepted by all of its bodies. The list is then evaluated with the MIPP kernel of the direct
+ * SIMD code, one register of bodies of the group at a time. With the quadrupole moments, the accepted cells get a
+ * list of their own evaluated with the second order kernel.
+ */
+class SimulationNBodyBarnesHutSIMD : public SimulationNBodyBarnesHut {
+  protected:
+    mipp::vector<float> listQx;             /*!< Interaction list of the current group. */
+    mipp::vector<float> listQy;
+    mipp::vector<float> listQz;
+    mipp::vector<float> listM;
+    std::vector<float> listCells;           /*!< Accepted cells of the group when they carry their quadrupole moments:
+                                                 position, mass and the 6 moments of each. */
+
+  public:
+    SimulationNBodyBarnesHutSIMD(const unsigned long nBodies, const std::string &scheme = "galaxy",
+                                 const float soft = 0.035f, const unsigned long randInit = 0);
+    virtual ~SimulationNBodyBarnesHutSIMD() = default;
+
+  protected:
+    void computeBodiesAcceleration() override;
+    void computeGroupAcceleration(const unsigned first, const unsigned last);
+};
+
+#endif /* SIMULATION_N_BODY_BARNES_HUT_SIMD_HPP_ */
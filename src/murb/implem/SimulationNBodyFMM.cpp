@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <omp.h>
+
+#include "SimulationNBodyFMM.hpp"
+
+// number of multi-indices of degree at most FMM_MAX_ORDER, bounds the scratch expansions
+constexpr unsigned FMM_MAX_COEFS = (FMM_MAX_ORDER + 1) * (FMM_MAX_ORDER + 2) * (FMM_MAX_ORDER + 3) / 6;
+
+SimulationNBodyFMM::SimulationNBodyFMM(const unsigned long nBodies, const std::string &scheme, const float soft,
+                                       const unsigned long randInit)
+    : SimulationNBodyBarnesHutOMP(nBodies, scheme, soft, randInit)
+{
+    this->leafAx.resize(nBodies);
+    this->leafAy.resize(nBodies);
+    this->leafAz.resize(nBodies);
+    this->allocatedBytes += 3 * nBodies * sizeof(float);
+    this->setOrder(4);
+    this->setBucketSize(FMM_BUCKET_SIZE);
+}
+
+void SimulationNBodyFMM::setOrder(const unsigned order)
+{
+    this->order = std::min(std::max(order, 1u), (unsigned)FMM_MAX_ORDER);
+    const int p = this->order;
+
+    // the multi-indices are sorted by degree, so that the recurrences only read already computed terms
+    this->coefIndex.assign((p + 1) * (p + 1) * (p + 1), -1);
+    this->coefExp.clear();
+    this->nCoefs = 0;
+    for (int degree=0;degree<=p;degree++)
+        for (int a=degree;a>=0;a--)
+            for (int b=degree-a;b>=0;b--) {
+                const int c = degree - a - b;
+                this->coefIndex[(a * (p + 1) + b) * (p + 1) + c] = this->nCoefs++;
+                this->coefExp.push_back(a);
+                this->coefExp.push_back(b);
+                this->coefExp.push_back(c);
+            }
+
+    this->m2lTerms.clear();
+    this->shiftTerms.clear();
+    for (unsigned n=0;n<this->nCoefs;n++)
+        for (unsigned k=0;k<this->nCoefs;k++) {
+            const int *en = &this->coefExp[3 * n], *ek = &this->coefExp[3 * k];
+            if (en[0] + en[1] + en[2] + ek[0] + ek[1] + ek[2] <= p) {
+                this->m2lTerms.push_back(n);
+                this->m2lTerms.push_back(k);
+                this->m2lTerms.push_back(this->coefIndex[((en[0] + ek[0]) * (p + 1) + en[1] + ek[1]) * (p + 1) + en[2] + ek[2]]);
+            }
+            if (ek[0] <= en[0] && ek[1] <= en[1] && ek[2] <= en[2]) {
+                this->shiftTerms.push_back(n);
+                this->shiftTerms.push_back(k);
+                this->shiftTerms.push_back(this->coefIndex[((en[0] - ek[0]) * (p + 1) + en[1] - ek[1]) * (p + 1) + en[2] - ek[2]]);
+            }
+        }
+}
+
+unsigned long SimulationNBodyFMM::getNodeBytes() const
+{
+    return SimulationNBodyBarnesHutOMP::getNodeBytes() + (this->multipoles.capacity() + this->locals.capacity()) *
+           sizeof(double) + this->radius.capacity() * sizeof(float);
+}
+
+void SimulationNBodyFMM::computePowers(const double x, const double y, const double z, double *powers) const
+{
+    // powers[(a, b, c)] = x^a y^b z^c / (a! b! c!)
+    const int p = this->order;
+    double px[FMM_MAX_ORDER + 1], py[FMM_MAX_ORDER + 1], pz[FMM_MAX_ORDER + 1];
+    px[0] = py[0] = pz[0] = 1;
+    for (int i=1;i<=p;i++) {
+        px[i] = px[i - 1] * x / i;
+        py[i] = py[i - 1] * y / i;
+        pz[i] = pz[i - 1] * z / i;
+    }
+    for (unsigned i=0;i<this->nCoefs;i++)
+        powers[i] = px[this->coefExp[3 * i]] * py[this->coefExp[3 * i + 1]] * pz[this->coefExp[3 * i + 2]];
+}
+
+void SimulationNBodyFMM::computeDerivatives(const double x, const double y, const double z, double *derivatives) const
+{
+    // McMurchie-Davidson recurrence on the softened kernel f = (r² + e²)^{-1/2}, seen as a function of u = r²/2:
+    // R_0^(m) = d^m f / du^m and R_{n+e_x}^(m) = x R_n^(m+1) + n_x R_{n-e_x}^(m+1), the derivatives are the R_n^(0)
+    const int p = this->order;
+    const double pos[3] = {x, y, z};
+    double R[FMM_MAX_COEFS][FMM_MAX_ORDER + 1];
+
+    const double inv = 1 / (x * x + y * y + z * z + (double)this->softSquared);
+    R[0][0] = std::sqrt(inv);
+    for (int m=0;m<p;m++)
+        R[0][m + 1] = -(2 * m + 1) * R[0][m] * inv;
+
+    for (unsigned i=1;i<this->nCoefs;i++) {
+        const int *e = &this->coefExp[3 * i];
+        const int axis = e[0] > 0 ? 0 : (e[1] > 0 ? 1 : 2);
+        int ep[3] = {e[0], e[1], e[2]};
+        ep[axis]--;
+        const unsigned parent = this->coefIndex[(ep[0] * (p + 1) + ep[1]) * (p + 1) + ep[2]];
+        const int n_axis = ep[axis];
+        const int degree = e[0] + e[1] + e[2];
+        if (n_axis > 0) {
+            ep[axis]--;
+            const unsigned grand_parent = this->coefIndex[(ep[0] * (p + 1) + ep[1]) * (p + 1) + ep[2]];
+            for (int m=0;m<=p-degree;m++)
+                R[i][m] = pos[axis] * R[parent][m + 1] + n_axis * R[grand_parent][m + 1];
+        } else {
+            for (int m=0;m<=p-degree;m++)
+                R[i][m] = pos[axis] * R[parent][m + 1];
+        }
+    }
+
+    for (unsigned i=0;i<this->nCoefs;i++)
+        derivatives[i] = R[i][0];
+}
+
+void SimulationNBodyFMM::upwardPass(const unsigned node, const int level)
+{
+    // P2M in the leaves, M2M in the internal nodes, all around the centers of mass
+    const FlatNode &f = this->flatTree[node];
+    double *M = &this->multipoles[(unsigned long)node * this->nCoefs];
+    std::fill(M, M + this->nCoefs, 0);
+    double powers[FMM_MAX_COEFS];
+    float r = 0;
+
+    if (f.next == node + 1) {
+        for (unsigned b=f.first;b<f.first+f.count;b++) {
+            const double dx = this->leafQx[b] - f.CoMx, dy = this->leafQy[b] - f.CoMy, dz = this->leafQz[b] - f.CoMz;
+            this->computePowers(dx, dy, dz, powers);
+            for (unsigned k=0;k<this->nCoefs;k++)
+                M[k] += this->leafM[b] * powers[k];
+            r = std::max(r, (float)std::sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    } else {
+        for (unsigned c=node+1;c<f.next;c=this->flatTree[c].next) {
+            #pragma omp task if(level < FMM_TASK_LEVELS)
+            this->upwardPass(c, level + 1);
+        }
+        #pragma omp taskwait
+
+        for (unsigned c=node+1;c<f.next;c=this->flatTree[c].next) {
+            const FlatNode &child = this->flatTree[c];
+            const double dx = child.CoMx - f.CoMx, dy = child.CoMy - f.CoMy, dz = child.CoMz - f.CoMz;
+            this->computePowers(dx, dy, dz, powers);
+            const double *Mc = &this->multipoles[(unsigned long)c * this->nCoefs];
+            const unsigned n_terms = this->shiftTerms.size();
+            for (unsigned t=0;t<n_terms;t+=3)
+                M[this->shiftTerms[t]] += Mc[this->shiftTerms[t + 1]] * powers[this->shiftTerms[t + 2]];
+            r = std::max(r, (float)std::sqrt(dx * dx + dy * dy + dz * dz) + this->radius[c]);
+        }
+    }
+    this->radius[node] = r;
+}
+
+void SimulationNBodyFMM::multipoleToLocal(const unsigned target, const unsigned source)
+{
+    const FlatNode &t = this->flatTree[target], &s = this->flatTree[source];
+    double derivatives[FMM_MAX_COEFS], M[FMM_MAX_COEFS];
+    this->computeDerivatives((double)t.CoMx - s.CoMx, (double)t.CoMy - s.CoMy, (double)t.CoMz - s.CoMz, derivatives);
+
+    // the expansion is in powers of (source - center), the kernel is differentiated in (target - source)
+    const double *Ms = &this->multipoles[(unsigned long)source * this->nCoefs];
+    for (unsigned k=0;k<this->nCoefs;k++) {
+        const int *e = &this->coefExp[3 * k];
+        M[k] = (e[0] + e[1] + e[2]) % 2 ? -Ms[k] : Ms[k];
+    }
+
+    double *L = &this->locals[(unsigned long)target * this->nCoefs];
+    const unsigned n_terms = this->m2lTerms.size();
+    for (unsigned i=0;i<n_terms;i+=3)
+        L[this->m2lTerms[i]] += M[this->m2lTerms[i + 1]] * derivatives[this->m2lTerms[i + 2]];
+}
+
+void SimulationNBodyFMM::particleToParticle(const unsigned target, const unsigned source)
+{
+    // same computation as the direct sum of the Barnes-Hut leaves
+    const FlatNode &t = this->flatTree[target], &s = this->flatTree[source];
+    for (unsigned i=t.first;i<t.first+t.count;i++) {
+        float aix = 0, aiy = 0, aiz = 0;
+        for (unsigned j=s.first;j<s.first+s.count;j++) {
+            const float rijx = this->leafQx[j] - this->leafQx[i];
+            const float rijy = this->leafQy[j] - this->leafQy[i];
+            const float rijz = this->leafQz[j] - this->leafQz[i];
+            const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+            const float x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
+            const float aj = x * this->leafM[j];
+
+            aix += aj * rijx;
+            aiy += aj * rijy;
+            aiz += aj * rijz;
+        }
+        this->leafAx[i] += aix;
+        this->leafAy[i] += aiy;
+        this->leafAz[i] += aiz;
+    }
+}
+
+void SimulationNBodyFMM::interact(const unsigned target, const unsigned source, const int level)
+{
+    // Dual tree walk: all the interactions of a target node happen in one chain of calls, the children of a target are
+    // given to concurrent tasks and the children of a source are visited in sequence, so no update is concurrent.
+    const FlatNode &t = this->flatTree[target], &s = this->flatTree[source];
+    const bool t_leaf = t.next == target + 1, s_leaf = s.next == source + 1;
+
+    if (target != source) {
+        const float dx = t.CoMx - s.CoMx, dy = t.CoMy - s.CoMy, dz = t.CoMz - s.CoMz;
+        const float r = this->radius[target] + this->radius[source];
+        const bool cheap_p2p = t_leaf && s_leaf && t.count * s.count < this->nCoefs;
+        if (!cheap_p2p && r * r < FMM_THETA * FMM_THETA * (dx * dx + dy * dy + dz * dz)) {
+            this->multipoleToLocal(target, source);
+            return;
+        }
+    }
+
+    if (t_leaf && s_leaf) {
+        this->particleToParticle(target, source);
+    } else if (target == source) {
+        for (unsigned tc=target+1;tc<t.next;tc=this->flatTree[tc].next) {
+            #pragma omp task if(level < FMM_TASK_LEVELS)
+            for (unsigned sc=source+1;sc<s.next;sc=this->flatTree[sc].next)
+                this->interact(tc, sc, level + 1);
+        }
+        #pragma omp taskwait
+    } else if (s_leaf || (!t_leaf && this->radius[target] >= this->radius[source])) {
+        for (unsigned tc=target+1;tc<t.next;tc=this->flatTree[tc].next) {
+            #pragma omp task if(level < FMM_TASK_LEVELS)
+            this->interact(tc, source, level + 1);
+        }
+        #pragma omp taskwait
+    } else {
+        for (unsigned sc=source+1;sc<s.next;sc=this->flatTree[sc].next)
+            this->interact(target, sc, level + 1);
+    }
+}
+
+void SimulationNBodyFMM::downwardPass(const unsigned node, const int level)
+{
+    // L2L to the children, L2P in the leaves
+    const FlatNode &f = this->flatTree[node];
+    const double *L = &this->locals[(unsigned long)node * this->nCoefs];
+    double powers[FMM_MAX_COEFS];
+
+    if (f.next == node + 1) {
+        const int p = this->order;
+        for (unsigned b=f.first;b<f.first+f.count;b++) {
+            this->computePowers((double)this->leafQx[b] - f.CoMx, (double)this->leafQy[b] - f.CoMy,
+                                (double)this->leafQz[b] - f.CoMz, powers);
+            // the acceleration is G times the gradient of the expansion
+            double a[3] = {0, 0, 0};
+            for (unsigned n=0;n<this->nCoefs;n++) {
+                const int *e = &this->coefExp[3 * n];
+                if (e[0] + e[1] + e[2] == p)
+                    break;
+                a[0] += L[this->coefIndex[((e[0] + 1) * (p + 1) + e[1]) * (p + 1) + e[2]]] * powers[n];
+                a[1] += L[this->coefIndex[(e[0] * (p + 1) + e[1] + 1) * (p + 1) + e[2]]] * powers[n];
+                a[2] += L[this->coefIndex[(e[0] * (p + 1) + e[1]) * (p + 1) + e[2] + 1]] * powers[n];
+            }
+            this->leafAx[b] += this->G * a[0];
+            this->leafAy[b] += this->G * a[1];
+            this->leafAz[b] += this->G * a[2];
+        }
+        return;
+    }
+
+    for (unsigned c=node+1;c<f.next;c=this->flatTree[c].next) {
+        const FlatNode &child = this->flatTree[c];
+        this->computePowers((double)child.CoMx - f.CoMx, (double)child.CoMy - f.CoMy, (double)child.CoMz - f.CoMz,
+                            powers);
+        double *Lc = &this->locals[(unsigned long)c * this->nCoefs];
+        const unsigned n_terms = this->shiftTerms.size();
+        for (unsigned t=0;t<n_terms;t+=3)
+            Lc[this->shiftTerms[t + 1]] += L[this->shiftTerms[t]] * powers[this->shiftTerms[t + 2]];
+
+        #pragma omp task if(level < FMM_TASK_LEVELS)
+        this->downwardPass(c, level + 1);
+    }
+    #pragma omp taskwait
+}
+
+void SimulationNBodyFMM::computeBodiesAcceleration()
+{
+    const unsigned long n_bodies = this->getBodies().getN();
+    const unsigned n_nodes = this->flatTree.size();
+    this->multipoles.resize((unsigned long)n_nodes * this->nCoefs);
+    this->locals.resize((unsigned long)n_nodes * this->nCoefs);
+    this->radius.resize(n_nodes);
+    this->updateAllocatedBytes();
+
+    #pragma omp parallel
+    {
+        #pragma omp for
+        for (unsigned long i=0;i<(unsigned long)n_nodes*this->nCoefs;i++)
+            this->locals[i] = 0;
+        #pragma omp for
+        for (unsigned long i=0;i<n_bodies;i++)
+            this->leafAx[i] = this->leafAy[i] = this->leafAz[i] = 0;
+
+        #pragma omp single
+        {
+            this->upwardPass(0, 0);
+            this->interact(0, 0, 0);
+            this->downwardPass(0, 0);
+        }
+
+        // back to the order of the bodies
+        #pragma omp for
+        for (unsigned long i=0;i<n_bodies;i++) {
+            accAoS_t<float> &acc = this->accelerations[this->leafBodies[i]];
+            acc.ax = this->leafAx[i];
+            acc.ay = this->leafAy[i];
+            acc.az = this->leafAz[i];
+        }
+    }
+}
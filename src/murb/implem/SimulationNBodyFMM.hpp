@@ -0,0 +1,56 @@
+#ifndef SIMULATION_N_BODY_FMM_HPP_
+#define SIMULATION_N_BODY_FMM_HPP_
+
+#include <string>
+#include <vector>
+
+#include "core/SimulationNBodyInterface.hpp"
+#include "SimulationNBodyBarnesHutOMP.hpp"
+#include "core/Bodies.hpp"
+
+#define FMM_THETA 0.5f     // two cells interact through their expansions if (r_A + r_B) < FMM_THETA * distance
+#define FMM_MAX_ORDER 10   // highest supported expansion order
+#define FMM_TASK_LEVELS 4  // depth of the tree down to which the passes spawn OpenMP tasks
+#define FMM_BUCKET_SIZE 64 // default maximum number of bodies in a leaf, bigger leaves favor P2P over M2L
+
+/*!
+ * \class  SimulationNBodyFMM
+ * \brief  Fast multipole method on the Barnes-Hut octree.
+ *
+ * The tree is built by `SimulationNBodyBarnesHutOMP` and walked through its flattened form. Every node gets a
+ * multipole and a local Cartesian Taylor expansion of order `order` around its center of mass, the derivatives of the
+ * softened kernel are computed with the McMurchie-Davidson recurrence. A dual tree walk makes the cells interact
+ * through their expansions (M2L) when they are well separated and the leaves body by body (P2P) otherwise.
+ */
+class SimulationNBodyFMM : public SimulationNBodyBarnesHutOMP {
+  protected:
+    unsigned order;                       /*!< Expansion order. */
+    unsigned nCoefs;                      /*!< Number of coefficients of an expansion, i.e. of the multi-indices. */
+    std::vector<int> coefExp;             /*!< Exponents (x, y, z) of each multi-index, by increasing degree. */
+    std::vector<int> coefIndex;           /*!< Index of the multi-index (x, y, z) in `(order + 1)^3` layout. */
+    std::vector<unsigned> m2lTerms;       /*!< (n, k, n + k) triplets of the M2L products, |n| + |k| <= order. */
+    std::vector<unsigned> shiftTerms;     /*!< (k, j, k - j) triplets of the M2M and L2L shifts, j <= k. */
+
+    std::vector<double> multipoles;       /*!< Multipole expansion of each flat node. */
+    std::vector<double> locals;           /*!< Local expansion of each flat node. */
+    std::vector<float> radius;            /*!< Distance from the center of mass of each node to its farthest body. */
+
+  public:
+    SimulationNBodyFMM(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
+                       const unsigned long randInit = 0);
+    virtual ~SimulationNBodyFMM() = default;
+    void setOrder(const unsigned order);
+
+  protected:
+    void computeBodiesAcceleration() override;
+    unsigned long getNodeBytes() const override;
+    void computeDerivatives(const double x, const double y, const double z, double *derivatives) const;
+    void computePowers(const double x, const double y, const double z, double *powers) const;
+    void upwardPass(const unsigned node, const int level);
+    void downwardPass(const unsigned node, const int level);
+    void interact(const unsigned target, const unsigned source, const int level);
+    void multipoleToLocal(const unsigned target, const unsigned source);
+    void particleToParticle(const unsigned target, const unsigned source);
+};
+
+#endif /* SIMULATION_N_BODY_FMM_HPP_ */
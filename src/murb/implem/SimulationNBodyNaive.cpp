@@ -7,15 +7,16 @@
 
 #include "SimulationNBodyNaive.hpp"
 
-SimulationNBodyNaive::SimulationNBodyNaive(const unsigned long nBodies, const std::string &scheme, const float soft,
+template <typename T>
+SimulationNBodyNaive<T>::SimulationNBodyNaive(const unsigned long nBodies, const std::string &scheme, const T soft,
                                            const unsigned long randInit)
-    : SimulationNBodyInterface(nBodies, scheme, soft, randInit)
+    : SimulationNBodyInterface<T>(nBodies, scheme, soft, randInit)
 {
     this->flopsPerIte = 20.f * (float)this->getBodies().getN() * (float)this->getBodies().getN();
     this->accelerations.resize(this->getBodies().getN());
 }
 
-void SimulationNBodyNaive::initIteration()
+template <typename T> void SimulationNBodyNaive<T>::initIteration()
 {
     for (unsigned long iBody = 0; iBody < this->getBodies().getN(); iBody++) {
         this->accelerations[iBody].ax = 0.f;
@@ -24,24 +25,24 @@ void SimulationNBodyNaive::initIteration()
     }
 }
 
-void SimulationNBodyNaive::computeBodiesAcceleration()
+template <typename T> void SimulationNBodyNaive<T>::computeBodiesAcceleration()
 {
-    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+    const std::vector<dataAoS_t<T>> &d = this->getBodies().getDataAoS();
 
     // flops = n² * 20
     for (unsigned long iBody = 0; iBody < this->getBodies().getN(); iBody++) {
         // flops = n * 20
         for (unsigned long jBody = 0; jBody < this->getBodies().getN(); jBody++) {
-            const float rijx = d[jBody].qx - d[iBody].qx; // 1 flop
-            const float rijy = d[jBody].qy - d[iBody].qy; // 1 flop
-            const float rijz = d[jBody].qz - d[iBody].qz; // 1 flop
+            const T rijx = d[jBody].qx - d[iBody].qx; // 1 flop
+            const T rijy = d[jBody].qy - d[iBody].qy; // 1 flop
+            const T rijz = d[jBody].qz - d[iBody].qz; // 1 flop
 
             // compute the || rij ||² distance between body i and body j
-            const float rijSquared = std::pow(rijx, 2) + std::pow(rijy, 2) + std::pow(rijz, 2); // 5 flops
+            const T rijSquared = std::pow(rijx, 2) + std::pow(rijy, 2) + std::pow(rijz, 2); // 5 flops
             // compute e²
-            const float softSquared = std::pow(this->soft, 2); // 1 flops
+            const T softSquared = std::pow(this->soft, 2); // 1 flops
             // compute the acceleration value between body i and body j: || ai || = G.mj / (|| rij ||² + e²)^{3/2}
-            const float ai = this->G * d[jBody].m / std::pow(rijSquared + softSquared, 3.f / 2.f); // 5 flops
+            const T ai = this->G * d[jBody].m / std::pow(rijSquared + softSquared, 3.f / 2.f); // 5 flops
 
             // add the acceleration value into the acceleration vector: ai += || ai ||.rij
             this->accelerations[iBody].ax += ai * rijx; // 2 flops
@@ -51,10 +52,15 @@ void SimulationNBodyNaive::computeBodiesAcceleration()
     }
 }
 
-void SimulationNBodyNaive::computeOneIteration()
+template <typename T> void SimulationNBodyNaive<T>::computeOneIteration()
 {
     this->initIteration();
     this->computeBodiesAcceleration();
     // time integration
     this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
 }
+
+// ==================================================================================== explicit template instantiation
+template class SimulationNBodyNaive<double>;
+template class SimulationNBodyNaive<float>;
+// ==================================================================================== explicit template instantiation
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
@@ -7,71 +8,102 @@
 
 #include "SimulationNBodyOMP.hpp"
 
-SimulationNBodyOMP::SimulationNBodyOMP(const unsigned long nBodies, const std::string &scheme, const float soft,
+template <typename T>
+SimulationNBodyOMP<T>::SimulationNBodyOMP(const unsigned long nBodies, const std::string &scheme, const T soft,
                                            const unsigned long randInit)
-    : SimulationNBodyInterface(nBodies, scheme, soft, randInit)
+    : SimulationNBodyInterface<T>(nBodies, scheme, soft, randInit)
 {
     this->flopsPerIte = 30.f * ((float)this->getBodies().getN() * (float)this->getBodies().getN() - (float)this->getBodies().getN())/2;
     this->accelerations.resize(this->getBodies().getN());
+    this->threadAccelerations.resize(3 * this->getBodies().getN() * omp_get_max_threads());
+    this->allocatedBytes += this->threadAccelerations.size() * sizeof(T);
 }
 
-void SimulationNBodyOMP::initIteration()
+template <typename T> void SimulationNBodyOMP<T>::computeBodiesAcceleration()
 {
-    unsigned long nBodies = this->getBodies().getN();
+    const dataSoA_t<T> &d = this->getBodies().getDataSoA();
 
-    for (unsigned long iBody = 0; iBody < nBodies; iBody++) {
-        this->accelerations[iBody].ax = 0.f;
-        this->accelerations[iBody].ay = 0.f;
-        this->accelerations[iBody].az = 0.f;
+    // compute e²
+    const T softSquared = std::pow(this->soft, 2); // 1 flops
+    const unsigned long nBodies = this->getBodies().getN();
+    if (this->threadAccelerations.size() < 3 * nBodies * omp_get_max_threads()) {
+        // nothing to keep, emptied first so that the main thread does not copy (and place) the old buffer
+        this->threadAccelerations.clear();
+        this->threadAccelerations.resize(3 * nBodies * omp_get_max_threads());
     }
-}
 
-void SimulationNBodyOMP::computeBodiesAcceleration()
+    // Each pair is computed once and its two contributions are written in the buffer of the thread, the buffers are
+    // summed at the end in the order of the threads. The row iBody has nBodies - 1 - iBody pairs: it is computed with
+    // the row nBodies - 1 - iBody so that every iteration of the loop has the same cost and the static schedule is
+    // balanced, which also keeps the results the same from one run to the other.
+#pragma omp parallel
 {
-    const dataSoA_t<float> &d = this->getBodies().getDataSoA();
+    T *acc = &this->threadAccelerations[3 * nBodies * omp_get_thread_num()];
+    T *accX = acc, *accY = acc + nBodies, *accZ = acc + 2 * nBodies;
+    std::fill(acc, acc + 3 * nBodies, (T)0);
 
-    // compute e²
-    const float softSquared = std::pow(this->soft, 2); // 1 flops
-    unsigned long nBodies = this->getBodies().getN();
+#pragma omp for schedule(static)
+    for (unsigned long k = 0; k < (nBodies + 1) / 2; k++) {
+        const unsigned long rows[2] = {k, nBodies - 1 - k};
+        for (int r = 0; r < ((rows[0] == rows[1]) ? 1 : 2); r++) {
+            const unsigned long iBody = rows[r];
+            T ax = 0, ay = 0, az = 0;
+            // flops = n * 20
+            for (unsigned long jBody = iBody + 1; jBody < nBodies; jBody++) {
+                const T rijx = d.qx[jBody] - d.qx[iBody]; // 1 flop
+                const T rijy = d.qy[jBody] - d.qy[iBody]; // 1 flop
+                const T rijz = d.qz[jBody] - d.qz[iBody]; // 1 flop
 
-    // flops = n² * 20
-#pragma omp parallel
-{
-#pragma omp for
-    for (unsigned long iBody = 0; iBody < nBodies; iBody++) {
-        // flops = n * 20
-        for (unsigned long jBody = iBody + 1; jBody < nBodies; jBody++) {
-            const float rijx = d.qx[jBody] - d.qx[iBody]; // 1 flop
-            const float rijy = d.qy[jBody] - d.qy[iBody]; // 1 flop
-            const float rijz = d.qz[jBody] - d.qz[iBody]; // 1 flop
+                // compute the || rij ||² distance between body i and body j
+                const T rijSquared = rijx * rijx + rijy * rijy + rijz * rijz; // 5 flops
 
-            // compute the || rij ||² distance between body i and body j
-            const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz; // 5 flops
+                // compute the acceleration value between body i and body j: || ai || = G.mj / (|| rij ||² + e²)^{3/2}
+                const T x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
 
-            // compute the acceleration value between body i and body j: || ai || = G.mj / (|| rij ||² + e²)^{3/2}
-            const float x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
+                const T ai = x * d.m[jBody]; // 1 flops
+                const T aj = x * d.m[iBody]; // 1 flops
 
-            const float ai = x * d.m[jBody]; // 1 flops
-            const float aj = x * d.m[iBody]; // 1 flops
+                // add the acceleration value into the acceleration vector: ai += || ai ||.rij
+                ax += ai * rijx; // 2 flops
+                ay += ai * rijy; // 2 flops
+                az += ai * rijz; // 2 flops
 
-            // add the acceleration value into the acceleration vector: ai += || ai ||.rij
-            this->accelerations[iBody].ax += ai * rijx; // 2 flops
-            this->accelerations[iBody].ay += ai * rijy; // 2 flops
-            this->accelerations[iBody].az += ai * rijz; // 2 flops
-            
-            this->accelerations[jBody].ax += aj * -rijx; // 2 flops
-            this->accelerations[jBody].ay += aj * -rijy; // 2 flops
-            this->accelerations[jBody].az += aj * -rijz; // 2 flops
+                accX[jBody] -= aj * rijx; // 2 flops
+                accY[jBody] -= aj * rijy; // 2 flops
+                accZ[jBody] -= aj * rijz; // 2 flops
+            }
+            accX[iBody] += ax;
+            accY[iBody] += ay;
+            accZ[iBody] += az;
         }
     }
-}
 
+    const int nThreads = omp_get_num_threads();
+#pragma omp for schedule(static)
+    for (unsigned long b = 0; b < nBodies; b++) {
+        T ax = 0, ay = 0, az = 0;
+        for (int th = 0; th < nThreads; th++) {
+            const T *other = &this->threadAccelerations[3 * nBodies * th];
+            ax += other[b];
+            ay += other[nBodies + b];
+            az += other[2 * nBodies + b];
+        }
+        this->accelerations[b].ax = ax;
+        this->accelerations[b].ay = ay;
+        this->accelerations[b].az = az;
+    }
+}
 }
 
-void SimulationNBodyOMP::computeOneIteration()
+template <typename T> void SimulationNBodyOMP<T>::computeOneIteration()
 {
-    this->initIteration();
+    // the sum of the buffers of the threads writes every acceleration, nothing to reset
     this->computeBodiesAcceleration();
     // time integration
     this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
 }
+
+// ==================================================================================== explicit template instantiation
+template class SimulationNBodyOMP<double>;
+template class SimulationNBodyOMP<float>;
+// ==================================================================================== explicit template instantiation
@@ -2,22 +2,24 @@
 #define SIMULATION_N_BODY_OMP_HPP_
 
 #include <string>
+#include <vector>
 #include <omp.h>
 
 #include "core/SimulationNBodyInterface.hpp"
 
-class SimulationNBodyOMP : public SimulationNBodyInterface {
+template <typename T> class SimulationNBodyOMP : public SimulationNBodyInterface<T> {
   protected:
-    std::vector<accAoS_t<float>> accelerations; /*!< Array of body acceleration structures. */
+    std::vector<accAoS_t<T>> accelerations; /*!< Array of body acceleration structures. */
+    soaArray_t<T> threadAccelerations;      /*!< Accelerations computed by each thread, x, y and z of all the bodies,
+                                                 placed by the thread that zeroes it. */
 
   public:
-    SimulationNBodyOMP(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
+    SimulationNBodyOMP(const unsigned long nBodies, const std::string &scheme = "galaxy", const T soft = 0.035f,
                          const unsigned long randInit = 0);
     virtual ~SimulationNBodyOMP() = default;
     virtual void computeOneIteration();
 
   protected:
-    void initIteration();
     void computeBodiesAcceleration();
 };
 
@@ -7,15 +7,16 @@
 
 #include "SimulationNBodyOptim.hpp"
 
-SimulationNBodyOptim::SimulationNBodyOptim(const unsigned long nBodies, const std::string &scheme, const float soft,
+template <typename T>
+SimulationNBodyOptim<T>::SimulationNBodyOptim(const unsigned long nBodies, const std::string &scheme, const T soft,
                                            const unsigned long randInit)
-    : SimulationNBodyInterface(nBodies, scheme, soft, randInit)
+    : SimulationNBodyInterface<T>(nBodies, scheme, soft, randInit)
 {
     this->flopsPerIte = 30.f * ((float)this->getBodies().getN() * (float)this->getBodies().getN() - (float)this->getBodies().getN())/2;
     this->accelerations.resize(this->getBodies().getN());
 }
 
-void SimulationNBodyOptim::initIteration()
+template <typename T> void SimulationNBodyOptim<T>::initIteration()
 {
     for (unsigned long iBody = 0; iBody < this->getBodies().getN(); iBody++) {
         this->accelerations[iBody].ax = 0.f;
@@ -24,12 +25,12 @@ void SimulationNBodyOptim::initIteration()
     }
 }
 
-void SimulationNBodyOptim::computeBodiesAcceleration()
+template <typename T> void SimulationNBodyOptim<T>::computeBodiesAcceleration()
 {
     //const dataSoA_t<float> &d = this->getBodies().getDataSoA();
-    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+    const std::vector<dataAoS_t<T>> &d = this->getBodies().getDataAoS();
     // compute e²
-    const float softSquared = std::pow(this->soft, 2); // 1 flops
+    const T softSquared = std::pow(this->soft, 2); // 1 flops
     unsigned long n_bodies = this->getBodies().getN();
 
     // flops = n² * 20
@@ -40,23 +41,23 @@ void SimulationNBodyOptim::computeBodiesAcceleration()
             // const float rijy = d.qy[jBody] - d.qy[iBody]; // 1 flop
             // const float rijz = d.qz[jBody] - d.qz[iBody]; // 1 flop
 
-            const float rijx = d[jBody].qx - d[iBody].qx; // 1 flop
-            const float rijy = d[jBody].qy - d[iBody].qy; // 1 flop
-            const float rijz = d[jBody].qz - d[iBody].qz; // 1 flop
+            const T rijx = d[jBody].qx - d[iBody].qx; // 1 flop
+            const T rijy = d[jBody].qy - d[iBody].qy; // 1 flop
+            const T rijz = d[jBody].qz - d[iBody].qz; // 1 flop
 
 
 
             // compute the || rij ||² distance between body i and body j
-            const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz; // 5 flops
+            const T rijSquared = rijx * rijx + rijy * rijy + rijz * rijz; // 5 flops
 
             // compute the acceleration value between body i and body j: || ai || = G.mj / (|| rij ||² + e²)^{3/2}
-            const float x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
+            const T x = this->G / ((rijSquared + softSquared) * std::sqrt(rijSquared + softSquared));
 
             // const float ai = x * d.m[jBody]; // 1 flops
             // const float aj = x * d.m[iBody]; // 1 flops
 
-            const float ai = x * d[jBody].m; // 1 flops
-            const float aj = x * d[iBody].m; // 1 flops
+            const T ai = x * d[jBody].m; // 1 flops
+            const T aj = x * d[iBody].m; // 1 flops
 
 
             // add the acceleration value into the acceleration vector: ai += || ai ||.rij
@@ -71,10 +72,15 @@ void SimulationNBodyOptim::computeBodiesAcceleration()
     }
 }
 
-void SimulationNBodyOptim::computeOneIteration()
+template <typename T> void SimulationNBodyOptim<T>::computeOneIteration()
 {
     this->initIteration();
     this->computeBodiesAcceleration();
     // time integration
     this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
 }
+
+// ==================================================================================== explicit template instantiation
+template class SimulationNBodyOptim<double>;
+template class SimulationNBodyOptim<float>;
+// ==================================================================================== explicit template instantiation
@@ -0,0 +1,43 @@
+#include <cassert>
+#include <cmath>
+#include <string>
+
+#include "SimulationNBodyPM.hpp"
+
+SimulationNBodyPM::SimulationNBodyPM(const unsigned long nBodies, const std::string &scheme, const float soft,
+                                     const unsigned long randInit)
+    : SimulationNBodyInterface<float>(nBodies, scheme, soft, randInit), mesh(G, soft)
+{
+    this->accelerations.resize(this->getBodies().getN());
+    this->allocatedBytes += this->mesh.getAllocatedBytes();
+    this->setGridSize(PM_GRID_SIZE);
+}
+
+void SimulationNBodyPM::setGridSize(const unsigned gridSize)
+{
+    this->allocatedBytes += this->mesh.setGridSize(gridSize);
+
+    // CIC assignment and interpolation, 2 FFTs of the padded mesh (the one of the Green's function is most of the time
+    // skipped) and the gradient
+    const float N = this->mesh.getGridSize(), M = 2 * N;
+    this->flopsPerIte = 2 * 60.f * this->getBodies().getN() + 2 * 5.f * M * M * M * std::log2(M) + 15.f * N * N * N;
+}
+
+void SimulationNBodyPM::initIteration()
+{
+    for (auto &acc : this->accelerations)
+        acc.ax = acc.ay = acc.az = 0.f;
+}
+
+void SimulationNBodyPM::computeBodiesAcceleration()
+{
+    this->mesh.computeAccelerations(this->getBodies(), this->accelerations);
+}
+
+void SimulationNBodyPM::computeOneIteration()
+{
+    this->initIteration();
+    this->computeBodiesAcceleration();
+    // time integration
+    this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
+}
@@ -0,0 +1,34 @@
+#ifndef SIMULATION_N_BODY_PM_HPP_
+#define SIMULATION_N_BODY_PM_HPP_
+
+#include <string>
+#include <vector>
+
+#include "core/SimulationNBodyInterface.hpp"
+#include "ParticleMesh.hpp"
+
+/*!
+ * \class  SimulationNBodyPM
+ * \brief  Particle-mesh gravity: the accelerations are all computed on the mesh of `ParticleMesh`.
+ *
+ * The cost is linear in the number of bodies plus O(M^3 log M) for the FFTs, but the forces are smoothed at the scale
+ * of a cell: the method suits big and rather uniform distributions of bodies.
+ */
+class SimulationNBodyPM : public SimulationNBodyInterface<float> {
+  protected:
+    std::vector<accAoS_t<float>> accelerations; /*!< Array of body acceleration structures. */
+    ParticleMesh mesh;                          /*!< Mesh solver. */
+
+  public:
+    SimulationNBodyPM(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
+                      const unsigned long randInit = 0);
+    virtual ~SimulationNBodyPM() = default;
+    virtual void computeOneIteration();
+    void setGridSize(const unsigned gridSize);
+
+  protected:
+    void initIteration();
+    void computeBodiesAcceleration();
+};
+
+#endif /* SIMULATION_N_BODY_PM_HPP_ */
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
@@ -7,26 +8,53 @@
 
 #include "mipp.h"
 
+#include "SimulationNBodySIMDKernel.hpp"
 #include "SimulationNBodySIMD.hpp"
 
-SimulationNBodySIMD::SimulationNBodySIMD(const unsigned long nBodies, const std::string &scheme, const float soft,
+template <typename T>
+SimulationNBodySIMD<T>::SimulationNBodySIMD(const unsigned long nBodies, const std::string &scheme, const T soft,
                                            const unsigned long randInit)
-    : SimulationNBodyInterface(nBodies, scheme, soft, randInit)
+    : SimulationNBodyInterface<T>(nBodies, scheme, soft, randInit), rsqrtIterations(0), compensated(false)
 {
     this->flopsPerIte = 30.f * ((float)this->getBodies().getN() * (float)this->getBodies().getN() - (float)this->getBodies().getN())/2;
-    this->accelerations.ax.resize(this->getBodies().getN() + this->getBodies().getPadding());
-    this->accelerations.ay.resize(this->getBodies().getN() + this->getBodies().getPadding());
-    this->accelerations.az.resize(this->getBodies().getN() + this->getBodies().getPadding());
 
+    // the padding bodies are massless and their accelerations are dropped
+    constexpr unsigned long B = SIMD_TILE_I * mipp::N<T>();
+    this->nPadded = (this->getBodies().getN() + B - 1) / B * B;
+    firstTouch(this->accelerations.ax, this->nPadded);
+    firstTouch(this->accelerations.ay, this->nPadded);
+    firstTouch(this->accelerations.az, this->nPadded);
+    this->paddedQx.resize(this->nPadded);
+    this->paddedQy.resize(this->nPadded);
+    this->paddedQz.resize(this->nPadded);
+    this->paddedM.resize(this->nPadded);
+    this->allocatedBytes += (this->nPadded - this->getBodies().getN()) * sizeof(T) * 3;
+    this->allocatedBytes += this->nPadded * sizeof(T) * 4;
 }
 
-void SimulationNBodySIMD::initIteration()
+template <typename T> void SimulationNBodySIMD<T>::initIteration()
 {
     std::fill(this->accelerations.ax.begin(),this->accelerations.ax.end(),0);
     std::fill(this->accelerations.ay.begin(),this->accelerations.ay.end(),0);
     std::fill(this->accelerations.az.begin(),this->accelerations.az.end(),0);
 }
 
+template <typename T> void SimulationNBodySIMD<T>::setRsqrtIterations(const unsigned rsqrtIterations)
+{
+    this->rsqrtIterations = std::min(rsqrtIterations, 2u);
+}
+
+template <typename T> void SimulationNBodySIMD<T>::setCompensated(const bool compensated)
+{
+    this->compensated = compensated;
+    if (compensated && this->compensations.ax.empty()) {
+        firstTouch(this->compensations.ax, this->nPadded);
+        firstTouch(this->compensations.ay, this->nPadded);
+        firstTouch(this->compensations.az, this->nPadded);
+        this->allocatedBytes += this->nPadded * sizeof(T) * 3;
+    }
+}
+
 void print_mipp_reg(mipp::Reg<float> reg) {
     constexpr int N = mipp::N<float>();
     float debug[N];
@@ -39,6 +67,71 @@ void print_mipp_reg(mipp::Reg<float> reg) {
 }
 
 
+template <typename T> void SimulationNBodySIMD<T>::computeBodiesAcceleration()
+{
+    switch (this->rsqrtIterations) {
+    case 0:
+        if (this->compensated)
+            this->template computeBodiesAccelerationTiles<0, true>();
+        else
+            this->template computeBodiesAccelerationTiles<0, false>();
+        break;
+    case 1:
+        if (this->compensated)
+            this->template computeBodiesAccelerationTiles<1, true>();
+        else
+            this->template computeBodiesAccelerationTiles<1, false>();
+        break;
+    default:
+        if (this->compensated)
+            this->template computeBodiesAccelerationTiles<2, true>();
+        else
+            this->template computeBodiesAccelerationTiles<2, false>();
+    }
+}
+
+//Third version
+template <typename T>
+template <int NR, bool KAHAN>
+void SimulationNBodySIMD<T>::computeBodiesAccelerationTiles()
+{
+    const dataSoA_t<T> &d = this->getBodies().getDataSoA();
+    // compute e²
+    const T softSquared = std::pow(this->soft, 2); // 1 flops
+    const unsigned long n_bodies = this->getBodies().getN();
+    constexpr int N = mipp::N<T>();
+    const mipp::Reg<T> softSquared_v = softSquared;
+    const mipp::Reg<T> G_v = this->G;
+
+    std::copy(d.qx.begin(), d.qx.begin() + n_bodies, this->paddedQx.begin());
+    std::copy(d.qy.begin(), d.qy.begin() + n_bodies, this->paddedQy.begin());
+    std::copy(d.qz.begin(), d.qz.begin() + n_bodies, this->paddedQz.begin());
+    std::copy(d.m.begin(), d.m.begin() + n_bodies, this->paddedM.begin());
+
+    if (KAHAN) {
+        std::fill(this->compensations.ax.begin(), this->compensations.ax.end(), 0.f);
+        std::fill(this->compensations.ay.begin(), this->compensations.ay.end(), 0.f);
+        std::fill(this->compensations.az.begin(), this->compensations.az.end(), 0.f);
+    }
+
+    // each tile computes its pairs with the bodies after it, which covers every pair once
+    for (unsigned long iBody = 0; iBody < this->nPadded; iBody += SIMD_TILE_I * N)
+        computeSymmetricTileSIMD<T, SIMD_TILE_I, SIMD_TILE_J, NR, KAHAN>(
+            this->paddedQx.data(), this->paddedQy.data(), this->paddedQz.data(), this->paddedM.data(), iBody,
+            this->nPadded, softSquared_v, G_v, this->accelerations.ax.data(), this->accelerations.ay.data(),
+            this->accelerations.az.data(), this->compensations.ax.data(), this->compensations.ay.data(),
+            this->compensations.az.data());
+
+    if (KAHAN)
+        for (unsigned long b = 0; b < n_bodies; b++) {
+            this->accelerations.ax[b] -= this->compensations.ax[b];
+            this->accelerations.ay[b] -= this->compensations.ay[b];
+            this->accelerations.az[b] -= this->compensations.az[b];
+        }
+}
+
+
+/*
 //Second version
 void SimulationNBodySIMD::computeBodiesAcceleration()
 {
@@ -65,44 +158,9 @@ void SimulationNBodySIMD::computeBodiesAcceleration()
         mipp::Reg<float> ay = 0.0;
         mipp::Reg<float> az = 0.0;
 
-        for (jBody = 0; jBody < n_bodies; jBody += 1) {
-            mipp::Reg<float> j_qx = d.qx[jBody]; //We duplicate : the same j for multiple i.
-            mipp::Reg<float> rijx = j_qx - i_qx;
-
-            mipp::Reg<float> j_qy = d.qy[jBody];
-            mipp::Reg<float> rijy = j_qy - i_qy;
-
-            mipp::Reg<float> j_qz = d.qz[jBody];
-            mipp::Reg<float> rijz = j_qz - i_qz;
-
-            mipp::Reg<float> rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
-            // mipp::Reg<float> rijSquared = rijx * rijx;  //fma doesn't seem to add to perf
-            // rijSquared = mipp::fmadd(rijy,rijy,rijSquared);
-            // rijSquared = mipp::fmadd(rijz,rijz,rijSquared);
-
-
-
-            mipp::Reg<float> x = G_v / ((rijSquared + softSquared_v) * mipp::sqrt(rijSquared + softSquared_v));
-            mipp::Reg<float> j_m = d.m[jBody];
-            mipp::Reg<float> ai = x * j_m; // 1 flops
-
-
-            mipp::Reg<float> i_ax = ai * rijx;
-            ax += i_ax;
-            mipp::Reg<float> i_ay = ai * rijy;
-            ay += i_ay;
-            mipp::Reg<float> i_az = ai * rijz;
-            az += i_az;
-
-
-            // mipp::Reg<float> aj = x * i_m; // 1 flops
-
-
-            // mipp::Reg<float> j_ax = aj * rijx;
-            // mipp::Reg<float> j_ay = aj * rijy;
-            // mipp::Reg<float> j_az = aj * rijz;
-
-        }
+        for (jBody = 0; jBody < n_bodies; jBody += 1)
+            accumulateAccelerationSIMD(i_qx, i_qy, i_qz, d.qx[jBody], d.qy[jBody], d.qz[jBody], d.m[jBody],
+                                       softSquared_v, G_v, ax, ay, az);
         
 
         ax.store(&this->accelerations.ax[iBody]);
@@ -111,6 +169,7 @@ void SimulationNBodySIMD::computeBodiesAcceleration()
 
     }
 }
+*/
 
 
 /*
@@ -202,10 +261,15 @@ void SimulationNBodySIMD::computeBodiesAcceleration()
 }
 */
 
-void SimulationNBodySIMD::computeOneIteration()
+template <typename T> void SimulationNBodySIMD<T>::computeOneIteration()
 {
     this->initIteration();
     this->computeBodiesAcceleration();
     // time integration
     this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
 }
+
+// ==================================================================================== explicit template instantiation
+template class SimulationNBodySIMD<double>;
+template class SimulationNBodySIMD<float>;
+// ==================================================================================== explicit template instantiation
@@ -3,21 +3,35 @@
 
 #include <string>
 
+#include "mipp.h"
+
 #include "core/SimulationNBodyInterface.hpp"
 
-class SimulationNBodySIMD : public SimulationNBodyInterface {
+template <typename T> class SimulationNBodySIMD : public SimulationNBodyInterface<T> {
   protected:
-    accSoA_t<float> accelerations;
+    accSoA_t<T> accelerations;          /*!< Accelerations of the bodies, padded like the positions. */
+    unsigned rsqrtIterations;           /*!< Newton-Raphson iterations refining the hardware rsqrt (0 for the exact
+                                             division and square root). */
+    bool compensated;                   /*!< Accumulate the accelerations with the compensated (Kahan) summation. */
+    unsigned long nPadded;              /*!< Number of bodies rounded up to a whole number of tiles. */
+    mipp::vector<T> paddedQx;           /*!< Positions and masses of the bodies, padded with massless bodies. */
+    mipp::vector<T> paddedQy;
+    mipp::vector<T> paddedQz;
+    mipp::vector<T> paddedM;
+    accSoA_t<T> compensations;          /*!< Compensations of the accelerations, when `compensated`. */
 
   public:
-    SimulationNBodySIMD(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
+    SimulationNBodySIMD(const unsigned long nBodies, const std::string &scheme = "galaxy", const T soft = 0.035f,
                          const unsigned long randInit = 0);
     virtual ~SimulationNBodySIMD() = default;
     virtual void computeOneIteration();
+    void setRsqrtIterations(const unsigned rsqrtIterations);
+    void setCompensated(const bool compensated);
 
   protected:
     void initIteration();
     void computeBodiesAcceleration();
+    template <int NR, bool KAHAN> void computeBodiesAccelerationTiles();
 };
 
 #endif /* SIMULATION_N_BODY_OPTIM_HPP_ */
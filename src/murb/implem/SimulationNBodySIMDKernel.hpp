@@ -0,0 +1,359 @@
+#ifndef SIMULATION_N_BODY_SIMD_KERNEL_HPP_
+#define SIMULATION_N_BODY_SIMD_KERNEL_HPP_
+
+#include "mipp.h"
+
+#define SIMD_TILE_I 2 // registers of bodies kept in registers by the symmetric tiles
+#define SIMD_TILE_J 2 // registers of following bodies streamed together through a symmetric tile
+
+/*!
+ * \fn     mipp::Reg<T> computeGravityFactorSIMD<T, NR>(...)
+ * \brief  Compute G / (s.sqrt(s)), the factor of the acceleration for a squared softened distance s.
+ *
+ * With NR = 0 the division and the square root are exact. Otherwise they are replaced by the hardware estimate of
+ * 1 / sqrt(s) refined by NR Newton-Raphson iterations, and by multiplications: each iteration about doubles the number
+ * of correct bits, from about 12, so fp32 needs one and fp64 two.
+ *
+ * \param  s   : Squared softened distances.
+ * \param  G_v : Gravitational constant.
+ *
+ * \return The factors G / (s.sqrt(s)).
+ */
+template <typename T, int NR>
+static inline mipp::Reg<T> computeGravityFactorSIMD(const mipp::Reg<T> &s, const mipp::Reg<T> &G_v)
+{
+    if (NR == 0)
+        return G_v / (s * mipp::sqrt(s));
+
+    const mipp::Reg<T> half_s = mipp::Reg<T>((T)0.5) * s;
+    mipp::Reg<T> r = mipp::rsqrt(s);
+    for (int k = 0; k < NR; k++)
+        r = r * (mipp::Reg<T>((T)1.5) - half_s * r * r);
+    return G_v * r * r * r;
+}
+
+/*!
+ * \fn     void accumulateAccelerationSIMD<T, NR>(...)
+ * \brief  Add the acceleration that one mass at (qx, qy, qz) applies to a register of bodies.
+ *
+ * The mass is broadcast to every lane: this is the inner loop of the direct SIMD kernels, shared with the group walk
+ * of the vectorized Barnes-Hut.
+ *
+ * \param  i_qx, i_qy, i_qz : Positions of the bodies receiving the acceleration.
+ * \param  qx, qy, qz, m    : Position and mass of the attracting body (or cell).
+ * \param  softSquared_v    : Squared softening factor.
+ * \param  G_v              : Gravitational constant.
+ * \param  ax, ay, az       : Accelerations of the bodies, updated in place.
+ */
+template <typename T, int NR = 0>
+static inline void accumulateAccelerationSIMD(const mipp::Reg<T> &i_qx, const mipp::Reg<T> &i_qy,
+                                              const mipp::Reg<T> &i_qz, const T qx, const T qy,
+                                              const T qz, const T m, const mipp::Reg<T> &softSquared_v,
+                                              const mipp::Reg<T> &G_v, mipp::Reg<T> &ax, mipp::Reg<T> &ay,
+                                              mipp::Reg<T> &az)
+{
+    mipp::Reg<T> j_qx = qx; //We duplicate : the same j for multiple i.
+    mipp::Reg<T> rijx = j_qx - i_qx;
+
+    mipp::Reg<T> j_qy = qy;
+    mipp::Reg<T> rijy = j_qy - i_qy;
+
+    mipp::Reg<T> j_qz = qz;
+    mipp::Reg<T> rijz = j_qz - i_qz;
+
+    mipp::Reg<T> rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+
+    mipp::Reg<T> x = computeGravityFactorSIMD<T, NR>(rijSquared + softSquared_v, G_v);
+    mipp::Reg<T> j_m = m;
+    mipp::Reg<T> ai = x * j_m; // 1 flops
+
+    ax += ai * rijx;
+    ay += ai * rijy;
+    az += ai * rijz;
+}
+
+/*!
+ * \fn     void interactRotatingSIMD<T, NR, J>(...)
+ * \brief  Compute every pair between `nI` registers of bodies i and J registers of bodies j, both ways.
+ *
+ * The registers j are rotated by one lane N times, so that each of their bodies meets every lane of the registers i.
+ * Their positions and accelerations are rotated in place, and are back in the order of the bodies at the end. Each
+ * pair is computed once and applied with opposite signs to both sides (Newton's third law). The J registers j are
+ * independent chains of operations interleaved in each rotation, J is a compile time constant so that the loop over
+ * them is fully unrolled.
+ *
+ * \param  i_qx, i_qy, i_qz, i_m : Positions and masses of the bodies i, `nI` registers.
+ * \param  i_ax, i_ay, i_az      : Accelerations of the bodies i, `nI` registers updated in place.
+ * \param  nI                    : Number of registers of bodies i.
+ * \param  j_qx, j_qy, j_qz, j_m : Positions and masses of the bodies j, J registers.
+ * \param  j_ax, j_ay, j_az      : Accelerations of the bodies j, J registers updated in place.
+ * \param  softSquared_v         : Squared softening factor.
+ * \param  G_v                   : Gravitational constant.
+ */
+template <typename T, int NR, int J = 1>
+static inline void interactRotatingSIMD(const mipp::Reg<T> *i_qx, const mipp::Reg<T> *i_qy,
+                                        const mipp::Reg<T> *i_qz, const mipp::Reg<T> *i_m,
+                                        mipp::Reg<T> *i_ax, mipp::Reg<T> *i_ay, mipp::Reg<T> *i_az,
+                                        const int nI, mipp::Reg<T> *j_qx, mipp::Reg<T> *j_qy,
+                                        mipp::Reg<T> *j_qz, mipp::Reg<T> *j_m, mipp::Reg<T> *j_ax,
+                                        mipp::Reg<T> *j_ay, mipp::Reg<T> *j_az,
+                                        const mipp::Reg<T> &softSquared_v, const mipp::Reg<T> &G_v)
+{
+    constexpr int N = mipp::N<T>();
+    for (int r = 0; r < N; r++) {
+        for (int k = 0; k < nI; k++) {
+            for (int u = 0; u < J; u++) {
+                const mipp::Reg<T> rijx = j_qx[u] - i_qx[k];
+                const mipp::Reg<T> rijy = j_qy[u] - i_qy[k];
+                const mipp::Reg<T> rijz = j_qz[u] - i_qz[k];
+                const mipp::Reg<T> rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+                const mipp::Reg<T> x = computeGravityFactorSIMD<T, NR>(rijSquared + softSquared_v, G_v);
+                const mipp::Reg<T> ai = x * j_m[u];
+                const mipp::Reg<T> aj = x * i_m[k];
+
+                i_ax[k] += ai * rijx;
+                i_ay[k] += ai * rijy;
+                i_az[k] += ai * rijz;
+                j_ax[u] -= aj * rijx;
+                j_ay[u] -= aj * rijy;
+                j_az[u] -= aj * rijz;
+            }
+        }
+        for (int u = 0; u < J; u++) {
+            j_qx[u] = mipp::rrot(j_qx[u]);
+            j_qy[u] = mipp::rrot(j_qy[u]);
+            j_qz[u] = mipp::rrot(j_qz[u]);
+            j_m[u] = mipp::rrot(j_m[u]);
+            j_ax[u] = mipp::rrot(j_ax[u]);
+            j_ay[u] = mipp::rrot(j_ay[u]);
+            j_az[u] = mipp::rrot(j_az[u]);
+        }
+    }
+}
+
+/*!
+ * \fn     void interactSelfSIMD<T, NR>(...)
+ * \brief  Compute every pair between the bodies of one register.
+ *
+ * The N - 1 rotations of the register meet each pair twice, once from each side, so only the bodies i are updated.
+ *
+ * \param  i_qx, i_qy, i_qz, i_m : Positions and masses of the bodies.
+ * \param  i_ax, i_ay, i_az      : Accelerations of the bodies, updated in place.
+ * \param  softSquared_v         : Squared softening factor.
+ * \param  G_v                   : Gravitational constant.
+ */
+template <typename T, int NR>
+static inline void interactSelfSIMD(const mipp::Reg<T> &i_qx, const mipp::Reg<T> &i_qy,
+                                    const mipp::Reg<T> &i_qz, const mipp::Reg<T> &i_m, mipp::Reg<T> &i_ax,
+                                    mipp::Reg<T> &i_ay, mipp::Reg<T> &i_az,
+                                    const mipp::Reg<T> &softSquared_v, const mipp::Reg<T> &G_v)
+{
+    constexpr int N = mipp::N<T>();
+    mipp::Reg<T> j_qx = i_qx, j_qy = i_qy, j_qz = i_qz, j_m = i_m;
+    for (int r = 1; r < N; r++) {
+        j_qx = mipp::rrot(j_qx);
+        j_qy = mipp::rrot(j_qy);
+        j_qz = mipp::rrot(j_qz);
+        j_m = mipp::rrot(j_m);
+
+        const mipp::Reg<T> rijx = j_qx - i_qx;
+        const mipp::Reg<T> rijy = j_qy - i_qy;
+        const mipp::Reg<T> rijz = j_qz - i_qz;
+        const mipp::Reg<T> rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+        const mipp::Reg<T> ai = computeGravityFactorSIMD<T, NR>(rijSquared + softSquared_v, G_v) * j_m;
+
+        i_ax += ai * rijx;
+        i_ay += ai * rijy;
+        i_az += ai * rijz;
+    }
+}
+
+/*!
+ * \fn     void accumulateCompensatedSIMD<T>(...)
+ * \brief  Add `value` to the sum `sum` with the compensated (Kahan) summation.
+ *
+ * `compensation` holds the low order bits lost by the previous additions, negated: the sum is `sum - compensation`.
+ * The order of the operations matters, the code must not be compiled with -ffast-math.
+ *
+ * \param  value        : Value to add.
+ * \param  sum          : Running sum, updated in place.
+ * \param  compensation : Running compensation, updated in place.
+ */
+template <typename T>
+static inline void accumulateCompensatedSIMD(const mipp::Reg<T> &value, mipp::Reg<T> &sum,
+                                             mipp::Reg<T> &compensation)
+{
+    const mipp::Reg<T> y = value - compensation;
+    const mipp::Reg<T> t = sum + y;
+    compensation = (t - sum) - y;
+    sum = t;
+}
+
+/*!
+ * \fn     void interactStreamSIMD<T, I, J, NR, KAHAN>(...)
+ * \brief  Compute the pairs between the I registers of a symmetric tile and the J registers of bodies from `jBody`.
+ *
+ * The accelerations of the bodies j are read and written back in memory, see `computeSymmetricTileSIMD` for the
+ * parameters.
+ */
+template <typename T, int I, int J, int NR, bool KAHAN>
+static inline void interactStreamSIMD(const mipp::Reg<T> *r_qx, const mipp::Reg<T> *r_qy, const mipp::Reg<T> *r_qz,
+                                      const mipp::Reg<T> *r_m, mipp::Reg<T> *r_ax, mipp::Reg<T> *r_ay,
+                                      mipp::Reg<T> *r_az, mipp::Reg<T> *r_cx, mipp::Reg<T> *r_cy,
+                                      mipp::Reg<T> *r_cz, const T *qx, const T *qy, const T *qz, const T *m,
+                                      const unsigned long jBody, const mipp::Reg<T> &softSquared_v,
+                                      const mipp::Reg<T> &G_v, T *ax, T *ay, T *az, T *cx, T *cy, T *cz)
+{
+    constexpr int N = mipp::N<T>();
+    mipp::Reg<T> j_qx[J], j_qy[J], j_qz[J], j_m[J], j_ax[J], j_ay[J], j_az[J];
+    for (int u = 0; u < J; u++) {
+        j_qx[u].loadu(&qx[jBody + u * N]);
+        j_qy[u].loadu(&qy[jBody + u * N]);
+        j_qz[u].loadu(&qz[jBody + u * N]);
+        j_m[u].loadu(&m[jBody + u * N]);
+    }
+    if (KAHAN) {
+        mipp::Reg<T> t_ax[I], t_ay[I], t_az[I];
+        for (int k = 0; k < I; k++) {
+            t_ax[k] = (T)0;
+            t_ay[k] = (T)0;
+            t_az[k] = (T)0;
+        }
+        for (int u = 0; u < J; u++) {
+            j_ax[u] = (T)0;
+            j_ay[u] = (T)0;
+            j_az[u] = (T)0;
+        }
+        interactRotatingSIMD<T, NR, J>(r_qx, r_qy, r_qz, r_m, t_ax, t_ay, t_az, I, j_qx, j_qy, j_qz, j_m, j_ax, j_ay,
+                                       j_az, softSquared_v, G_v);
+        for (int k = 0; k < I; k++) {
+            accumulateCompensatedSIMD(t_ax[k], r_ax[k], r_cx[k]);
+            accumulateCompensatedSIMD(t_ay[k], r_ay[k], r_cy[k]);
+            accumulateCompensatedSIMD(t_az[k], r_az[k], r_cz[k]);
+        }
+
+        for (int u = 0; u < J; u++) {
+            const unsigned long b = jBody + u * N;
+            mipp::Reg<T> s_x, s_y, s_z, c_x, c_y, c_z;
+            s_x.loadu(&ax[b]);
+            s_y.loadu(&ay[b]);
+            s_z.loadu(&az[b]);
+            c_x.loadu(&cx[b]);
+            c_y.loadu(&cy[b]);
+            c_z.loadu(&cz[b]);
+            accumulateCompensatedSIMD(j_ax[u], s_x, c_x);
+            accumulateCompensatedSIMD(j_ay[u], s_y, c_y);
+            accumulateCompensatedSIMD(j_az[u], s_z, c_z);
+            s_x.storeu(&ax[b]);
+            s_y.storeu(&ay[b]);
+            s_z.storeu(&az[b]);
+            c_x.storeu(&cx[b]);
+            c_y.storeu(&cy[b]);
+            c_z.storeu(&cz[b]);
+        }
+    } else {
+        for (int u = 0; u < J; u++) {
+            j_ax[u].loadu(&ax[jBody + u * N]);
+            j_ay[u].loadu(&ay[jBody + u * N]);
+            j_az[u].loadu(&az[jBody + u * N]);
+        }
+        interactRotatingSIMD<T, NR, J>(r_qx, r_qy, r_qz, r_m, r_ax, r_ay, r_az, I, j_qx, j_qy, j_qz, j_m, j_ax, j_ay,
+                                       j_az, softSquared_v, G_v);
+        for (int u = 0; u < J; u++) {
+            j_ax[u].storeu(&ax[jBody + u * N]);
+            j_ay[u].storeu(&ay[jBody + u * N]);
+            j_az[u].storeu(&az[jBody + u * N]);
+        }
+    }
+}
+
+/*!
+ * \fn     void computeSymmetricTileSIMD<T, I, J, NR, KAHAN>(...)
+ * \brief  Compute the pairs of the I registers of bodies starting at `first` with themselves and with every following
+ *         body, and add them to the accelerations of both sides.
+ *
+ * Together, the tiles of a loop over `first` cover the upper triangle of the pairs, so each pair is computed once. The
+ * I registers stay in registers while the following bodies stream through J registers at a time, the last ones one
+ * register at a time. Their accelerations are read and written back in memory. I and J are compile time constants so
+ * that the loops over them are fully unrolled. NR selects the computation of the factor of the acceleration, as in
+ * `computeGravityFactorSIMD`.
+ *
+ * With KAHAN, the pairs of each register j are first summed apart, then added to the accelerations of both sides with
+ * the compensated summation: the rounding error no longer grows with the number of bodies. The compensations of the
+ * accelerations in memory are in `cx`, `cy` and `cz`, the accelerations are `ax - cx`.
+ *
+ * \param  qx, qy, qz, m : Positions and masses of the bodies, padded with massless bodies.
+ * \param  first         : First body of the tile.
+ * \param  n             : Number of (padded) bodies, a multiple of N, at least first + I.N.
+ * \param  softSquared_v : Squared softening factor.
+ * \param  G_v           : Gravitational constant.
+ * \param  ax, ay, az    : Accelerations of the bodies, updated in place.
+ * \param  cx, cy, cz    : Compensations of the accelerations with KAHAN, updated in place (unused otherwise).
+ */
+template <typename T, int I, int J, int NR, bool KAHAN>
+static inline void computeSymmetricTileSIMD(const T *qx, const T *qy, const T *qz, const T *m,
+                                            const unsigned long first, const unsigned long n,
+                                            const mipp::Reg<T> &softSquared_v, const mipp::Reg<T> &G_v,
+                                            T *ax, T *ay, T *az, T *cx, T *cy, T *cz)
+{
+    constexpr int N = mipp::N<T>();
+    mipp::Reg<T> r_qx[I], r_qy[I], r_qz[I], r_m[I];
+    mipp::Reg<T> r_ax[I], r_ay[I], r_az[I];
+    mipp::Reg<T> r_cx[I], r_cy[I], r_cz[I];
+    for (int k = 0; k < I; k++) {
+        r_qx[k].loadu(&qx[first + k * N]);
+        r_qy[k].loadu(&qy[first + k * N]);
+        r_qz[k].loadu(&qz[first + k * N]);
+        r_m[k].loadu(&m[first + k * N]);
+        r_ax[k] = (T)0;
+        r_ay[k] = (T)0;
+        r_az[k] = (T)0;
+        r_cx[k] = (T)0;
+        r_cy[k] = (T)0;
+        r_cz[k] = (T)0;
+    }
+
+    // the pairs inside the tile: each register with itself (N - 1 rotations), then with the registers before it, the
+    // first one has none
+    for (int k = 0; k < I; k++)
+        interactSelfSIMD<T, NR>(r_qx[k], r_qy[k], r_qz[k], r_m[k], r_ax[k], r_ay[k], r_az[k], softSquared_v, G_v);
+    for (int k = 1; k < I; k++)
+        interactRotatingSIMD<T, NR>(r_qx, r_qy, r_qz, r_m, r_ax, r_ay, r_az, k, &r_qx[k], &r_qy[k], &r_qz[k],
+                                    &r_m[k], &r_ax[k], &r_ay[k], &r_az[k], softSquared_v, G_v);
+
+    unsigned long jBody = first + I * N;
+    for (; jBody + J * N <= n; jBody += J * N)
+        interactStreamSIMD<T, I, J, NR, KAHAN>(r_qx, r_qy, r_qz, r_m, r_ax, r_ay, r_az, r_cx, r_cy, r_cz, qx, qy, qz,
+                                               m, jBody, softSquared_v, G_v, ax, ay, az, cx, cy, cz);
+    for (; jBody < n; jBody += N)
+        interactStreamSIMD<T, I, 1, NR, KAHAN>(r_qx, r_qy, r_qz, r_m, r_ax, r_ay, r_az, r_cx, r_cy, r_cz, qx, qy, qz,
+                                               m, jBody, softSquared_v, G_v, ax, ay, az, cx, cy, cz);
+
+    for (int k = 0; k < I; k++) {
+        mipp::Reg<T> s_x, s_y, s_z;
+        s_x.loadu(&ax[first + k * N]);
+        s_y.loadu(&ay[first + k * N]);
+        s_z.loadu(&az[first + k * N]);
+        if (KAHAN) {
+            mipp::Reg<T> c_x, c_y, c_z;
+            c_x.loadu(&cx[first + k * N]);
+            c_y.loadu(&cy[first + k * N]);
+            c_z.loadu(&cz[first + k * N]);
+            accumulateCompensatedSIMD(r_ax[k] - r_cx[k], s_x, c_x);
+            accumulateCompensatedSIMD(r_ay[k] - r_cy[k], s_y, c_y);
+            accumulateCompensatedSIMD(r_az[k] - r_cz[k], s_z, c_z);
+            c_x.storeu(&cx[first + k * N]);
+            c_y.storeu(&cy[first + k * N]);
+            c_z.storeu(&cz[first + k * N]);
+        } else {
+            s_x += r_ax[k];
+            s_y += r_ay[k];
+            s_z += r_az[k];
+        }
+        s_x.storeu(&ax[first + k * N]);
+        s_y.storeu(&ay[first + k * N]);
+        s_z.storeu(&az[first + k * N]);
+    }
+}
+
+#endif /* SIMULATION_N_BODY_SIMD_KERNEL_HPP_ */
@@ -1,153 +1,211 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <string>
-#include <atomic>
-#include <pthread.h>
+#include <unistd.h>
 
 #include "mipp.h"
 
+#include "utils/Affinity.hpp"
+
 #include "SimulationNBodySIMDPThread.hpp"
 
-#define NB_THREADS 6
 #define BATCH_SIZE 2
 
-SimulationNBodySIMDPThread::SimulationNBodySIMDPThread(const unsigned long nBodies, const std::string &scheme, const float soft,
-                                           const unsigned long randInit)
-    : SimulationNBodyInterface(nBodies, scheme, soft, randInit)
+template <typename T>
+SimulationNBodySIMDPThread<T>::SimulationNBodySIMDPThread(const unsigned long nBodies, const std::string &scheme,
+                                                          const T soft, const unsigned long randInit)
+    : SimulationNBodyInterface<T>(nBodies, scheme, soft, randInit), nThreads(0), stopping(false)
 {
     this->flopsPerIte = 30.f * ((float)this->getBodies().getN() * (float)this->getBodies().getN() - (float)this->getBodies().getN())/2;
-    this->accelerations.ax.resize(this->getBodies().getN() + this->getBodies().getPadding());
-    this->accelerations.ay.resize(this->getBodies().getN() + this->getBodies().getPadding());
-    this->accelerations.az.resize(this->getBodies().getN() + this->getBodies().getPadding());
 
+    // the i registers of the last block read and store up to N-1 bodies past the end
+    constexpr unsigned long N = mipp::N<T>();
+    this->nPadded = (this->getBodies().getN() + N - 1) / N * N;
+    firstTouch(this->accelerations.ax, this->nPadded);
+    firstTouch(this->accelerations.ay, this->nPadded);
+    firstTouch(this->accelerations.az, this->nPadded);
+    this->paddedQx.resize(this->nPadded);
+    this->paddedQy.resize(this->nPadded);
+    this->paddedQz.resize(this->nPadded);
+    this->allocatedBytes += (this->nPadded - this->getBodies().getN()) * sizeof(T) * 3;
+    this->allocatedBytes += this->nPadded * sizeof(T) * 3;
+
+    this->startPool();
+}
+
+template <typename T> SimulationNBodySIMDPThread<T>::~SimulationNBodySIMDPThread()
+{
+    this->stopPool();
+}
+
+template <typename T> void SimulationNBodySIMDPThread<T>::setThreads(const unsigned nThreads)
+{
+    this->stopPool();
+    this->nThreads = nThreads;
+    this->startPool();
+}
+
+template <typename T> unsigned SimulationNBodySIMDPThread<T>::getThreads() const
+{
+    return this->nThreads;
+}
+
+template <typename T> void SimulationNBodySIMDPThread<T>::setAffinity(const std::vector<int> &cores)
+{
+    this->affinity = cores;
+    for (unsigned t = 0; t < this->threads.size() && !cores.empty(); t++)
+        pinThread(this->threads[t], cores[(t + 1) % cores.size()]);
+}
+
+template <typename T> void SimulationNBodySIMDPThread<T>::startPool()
+{
+    if (this->nThreads == 0) {
+        const long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+        this->nThreads = (nCores > 0) ? nCores : 1;
+    }
+    this->stopping = false;
+    pthread_barrier_init(&this->barrier, NULL, this->nThreads);
+    // the calling thread is the last one of the pool
+    this->threads.resize(this->nThreads - 1);
+    for (unsigned t = 0; t < this->threads.size(); t++)
+        pthread_create(&this->threads[t], NULL, &SimulationNBodySIMDPThread<T>::worker, (void *)this);
+    this->setAffinity(this->affinity);
+}
+
+template <typename T> void SimulationNBodySIMDPThread<T>::stopPool()
+{
+    // wakes the threads up without work, they see `stopping` and exit
+    this->stopping = true;
+    pthread_barrier_wait(&this->barrier);
+    for (unsigned t = 0; t < this->threads.size(); t++)
+        pthread_join(this->threads[t], NULL);
+    this->threads.clear();
+    pthread_barrier_destroy(&this->barrier);
 }
 
-void SimulationNBodySIMDPThread::initIteration()
+template <typename T> void SimulationNBodySIMDPThread<T>::initIteration()
 {
     std::fill(this->accelerations.ax.begin(),this->accelerations.ax.end(),0);
     std::fill(this->accelerations.ay.begin(),this->accelerations.ay.end(),0);
     std::fill(this->accelerations.az.begin(),this->accelerations.az.end(),0);
 }
 
+template <typename T> void *SimulationNBodySIMDPThread<T>::worker(void *arg)
+{
+    SimulationNBodySIMDPThread<T> *that = (SimulationNBodySIMDPThread<T> *)arg;
+    while (true) {
+        // sleeps until the next iteration (or the end of the pool)
+        pthread_barrier_wait(&that->barrier);
+        if (that->stopping)
+            break;
+        that->computeBlocks();
+        pthread_barrier_wait(&that->barrier);
+    }
+    return NULL;
+}
 
-struct args {
-    std::atomic<unsigned long>* current;
-    SimulationNBodySIMDPThread *that;
-    const float soft;
-    const float G;
-};
 //Second version
-void* worker(void *arg)
+template <typename T> void SimulationNBodySIMDPThread<T>::computeBlocks()
 {
-    struct args *arg_s = (struct args *) arg;
-    const dataSoA_t<float> &d = arg_s->that->getBodies().getDataSoA();
+    const dataSoA_t<T> &d = this->getBodies().getDataSoA();
     // compute e²
-    const float softSquared = std::pow(arg_s->soft, 2); // 1 flops
-    unsigned long n_bodies = arg_s->that->getBodies().getN();
-    constexpr int N = mipp::N<float>();
+    const T softSquared = std::pow(this->soft, 2); // 1 flops
+    unsigned long n_bodies = this->getBodies().getN();
+    constexpr int N = mipp::N<T>();
 
     // flops = n² * 20
 
-    unsigned long iBody_main = arg_s->current->fetch_add(N*BATCH_SIZE);
-
-    // printf("thread %d got %ld\n", pthread_self(),iBody_main);
-
+    unsigned long iBody_main = this->current.fetch_add(N*BATCH_SIZE);
 
     while (iBody_main < n_bodies) {
         unsigned long iBody = iBody_main;
 #if BATCH_SIZE > 1 //This doesn't seem to impact much performance, but since it's hard to measure, it can't hurt (the compiler doesn't do it itself)
         for (iBody = iBody_main; iBody < iBody_main + N*BATCH_SIZE && iBody < n_bodies; iBody+=N) {
 #endif
-            // printf("thread %d : calculating %ld\n",pthread_self(),iBody);
             unsigned long jBody;
-            mipp::Reg<float> i_qx = &d.qx[iBody];
-            mipp::Reg<float> i_qy = &d.qy[iBody];
-            mipp::Reg<float> i_qz = &d.qz[iBody];
+            mipp::Reg<T> i_qx = &this->paddedQx[iBody];
+            mipp::Reg<T> i_qy = &this->paddedQy[iBody];
+            mipp::Reg<T> i_qz = &this->paddedQz[iBody];
 
 
-            mipp::Reg<float> softSquared_v = softSquared;
-            mipp::Reg<float> G_v = arg_s->G;
+            mipp::Reg<T> softSquared_v = softSquared;
+            mipp::Reg<T> G_v = this->G;
 
-            mipp::Reg<float> ax = 0.0;
-            mipp::Reg<float> ay = 0.0;
-            mipp::Reg<float> az = 0.0;
+            mipp::Reg<T> ax = 0.0;
+            mipp::Reg<T> ay = 0.0;
+            mipp::Reg<T> az = 0.0;
 
             for (jBody = 0; jBody < n_bodies; jBody += 1) {
-                mipp::Reg<float> j_qx = d.qx[jBody]; //We duplicate : the same j for multiple i.
-                mipp::Reg<float> rijx = j_qx - i_qx;
+                mipp::Reg<T> j_qx = d.qx[jBody]; //We duplicate : the same j for multiple i.
+                mipp::Reg<T> rijx = j_qx - i_qx;
 
-                mipp::Reg<float> j_qy = d.qy[jBody];
-                mipp::Reg<float> rijy = j_qy - i_qy;
+                mipp::Reg<T> j_qy = d.qy[jBody];
+                mipp::Reg<T> rijy = j_qy - i_qy;
 
-                mipp::Reg<float> j_qz = d.qz[jBody];
-                mipp::Reg<float> rijz = j_qz - i_qz;
+                mipp::Reg<T> j_qz = d.qz[jBody];
+                mipp::Reg<T> rijz = j_qz - i_qz;
 
-                mipp::Reg<float> rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+                mipp::Reg<T> rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
                 // mipp::Reg<float> rijSquared = rijx * rijx;  //fma doesn't seem to add to perf
                 // rijSquared = mipp::fmadd(rijy,rijy,rijSquared);
                 // rijSquared = mipp::fmadd(rijz,rijz,rijSquared);
 
 
 
-                mipp::Reg<float> x = G_v / ((rijSquared + softSquared_v) * mipp::sqrt(rijSquared + softSquared_v));
-                mipp::Reg<float> j_m = d.m[jBody];
-                mipp::Reg<float> ai = x * j_m; // 1 flops
+                mipp::Reg<T> x = G_v / ((rijSquared + softSquared_v) * mipp::sqrt(rijSquared + softSquared_v));
+                mipp::Reg<T> j_m = d.m[jBody];
+                mipp::Reg<T> ai = x * j_m; // 1 flops
 
 
-                mipp::Reg<float> i_ax = ai * rijx;
+                mipp::Reg<T> i_ax = ai * rijx;
                 ax += i_ax;
-                mipp::Reg<float> i_ay = ai * rijy;
+                mipp::Reg<T> i_ay = ai * rijy;
                 ay += i_ay;
-                mipp::Reg<float> i_az = ai * rijz;
+                mipp::Reg<T> i_az = ai * rijz;
                 az += i_az;
 
 
             }
             
 
-            ax.store(&arg_s->that->accelerations.ax[iBody]);
-            ay.store(&arg_s->that->accelerations.ay[iBody]);
-            az.store(&arg_s->that->accelerations.az[iBody]);
+            ax.store(&this->accelerations.ax[iBody]);
+            ay.store(&this->accelerations.ay[iBody]);
+            az.store(&this->accelerations.az[iBody]);
 #if BATCH_SIZE > 1            
         }
 #endif
-        iBody_main = arg_s->current->fetch_add(N*BATCH_SIZE);
-        // printf("thread %d got %ld\n", pthread_self(),iBody_main);
+        iBody_main = this->current.fetch_add(N*BATCH_SIZE);
     }
-    // printf("thread %d finished\n",pthread_self());
-    return NULL;
 }
 
-
-
-void SimulationNBodySIMDPThread::computeBodiesAcceleration() {
-    std::atomic<unsigned long> current;
-    current = 0;
-    pthread_t threads[NB_THREADS];
-    struct args arg = {
-        &current,
-        this,
-        this->soft,
-        this->G
-    };
-    for (int i=0;i<NB_THREADS;i++) {
-        pthread_create(&threads[i],NULL, &worker,(void*)&arg);
-        // printf("thread %d created (%ld) \n",i,threads[i]);
-    }
-    for (int i=0;i<NB_THREADS;i++) {
-        pthread_join(threads[i],NULL);
-        // printf("thread %d joined\n",i);
-    }
+template <typename T> void SimulationNBodySIMDPThread<T>::computeBodiesAcceleration() {
+    const dataSoA_t<T> &d = this->getBodies().getDataSoA();
+    const unsigned long n_bodies = this->getBodies().getN();
+    std::copy(d.qx.begin(), d.qx.begin() + n_bodies, this->paddedQx.begin());
+    std::copy(d.qy.begin(), d.qy.begin() + n_bodies, this->paddedQy.begin());
+    std::copy(d.qz.begin(), d.qz.begin() + n_bodies, this->paddedQz.begin());
+
+    // the first barrier wakes the pool up, the second one waits for the last block
+    this->current = 0;
+    pthread_barrier_wait(&this->barrier);
+    this->computeBlocks();
+    pthread_barrier_wait(&this->barrier);
 }
 
 
-void SimulationNBodySIMDPThread::computeOneIteration()
+template <typename T> void SimulationNBodySIMDPThread<T>::computeOneIteration()
 {
     this->initIteration();
     this->computeBodiesAcceleration();
     // time integration
     this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
 }
+
+// ==================================================================================== explicit template instantiation
+template class SimulationNBodySIMDPThread<double>;
+template class SimulationNBodySIMDPThread<float>;
+// ==================================================================================== explicit template instantiation
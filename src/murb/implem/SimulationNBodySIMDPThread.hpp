@@ -1,23 +1,68 @@
 #ifndef SIMULATION_N_BODY_SIMD_PTHREAD_HPP_
 #define SIMULATION_N_BODY_SIMD_PTHREAD_HPP_
 
+#include <atomic>
+#include <pthread.h>
 #include <string>
+#include <vector>
+
+#include "mipp.h"
 
 #include "core/SimulationNBodyInterface.hpp"
 
-class SimulationNBodySIMDPThread : public SimulationNBodyInterface {
+/*!
+ * \class  SimulationNBodySIMDPThread
+ * \brief  MIPP kernel computed by a pool of POSIX threads.
+ *
+ * The threads are created once with the simulation and sleep on a barrier between two iterations. At each iteration
+ * the calling thread joins them and they all pull blocks of bodies from a shared atomic counter until every body is
+ * computed, then wait on the barrier again.
+ */
+template <typename T> class SimulationNBodySIMDPThread : public SimulationNBodyInterface<T> {
   public:
-    accSoA_t<float> accelerations;
+    accSoA_t<T> accelerations;
+
+  protected:
+    unsigned long nPadded;               /*!< Number of bodies rounded up to a register. */
+    mipp::vector<T> paddedQx;            /*!< Positions of the bodies followed by the padding. */
+    mipp::vector<T> paddedQy;
+    mipp::vector<T> paddedQz;
+    unsigned nThreads;                   /*!< Number of threads computing an iteration, the calling one included. */
+    std::vector<pthread_t> threads;      /*!< Threads of the pool. */
+    pthread_barrier_t barrier;           /*!< Start and end of the iterations, shared by the pool and the caller. */
+    std::atomic<unsigned long> current;  /*!< First body of the next block to compute. */
+    bool stopping;                       /*!< The threads of the pool have to exit. */
+    std::vector<int> affinity;           /*!< Cores of the threads, the calling one first (empty to not pin them). */
 
   public:
-    SimulationNBodySIMDPThread(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
-                         const unsigned long randInit = 0);
-    virtual ~SimulationNBodySIMDPThread() = default;
+    SimulationNBodySIMDPThread(const unsigned long nBodies, const std::string &scheme = "galaxy", const T soft = 0.035f,
+                               const unsigned long randInit = 0);
+    virtual ~SimulationNBodySIMDPThread();
     virtual void computeOneIteration();
 
+    /*!
+     *  \brief Restart the pool with another number of threads.
+     *
+     *  \param nThreads : Number of threads computing an iteration, the calling one included (0 for the number of
+     *                    cores).
+     */
+    void setThreads(const unsigned nThreads);
+    unsigned getThreads() const;
+
+    /*!
+     *  \brief Pin the threads of the pool, the thread t of the pool to `cores[(t + 1) % cores.size()]`.
+     *
+     *  \param cores : Cores of the threads, the first one is the one of the calling thread (see `pinOpenMPThreads`).
+     */
+    void setAffinity(const std::vector<int> &cores);
+
   protected:
     void initIteration();
     void computeBodiesAcceleration();
+    void computeBlocks();
+    void startPool();
+    void stopPool();
+    static void *worker(void *arg);
 };
 
-#endif /* SIMULATION_N_BODY_OPTIM_HPP_ */
+#endif /* SIMULATION_N_BODY_SIMD_PTHREAD_HPP_ */
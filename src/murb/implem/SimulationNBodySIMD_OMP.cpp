@@ -1,32 +1,154 @@
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
 #include <iostream>
 #include <limits>
 #include <string>
+#include <omp.h>
 
 #include "mipp.h"
 
+#include "SimulationNBodySIMDKernel.hpp"
 #include "SimulationNBodySIMD_OMP.hpp"
 
-SimulationNBodySIMD_OMP::SimulationNBodySIMD_OMP(const unsigned long nBodies, const std::string &scheme, const float soft,
+template <typename T>
+SimulationNBodySIMD_OMP<T>::SimulationNBodySIMD_OMP(const unsigned long nBodies, const std::string &scheme, const T soft,
                                            const unsigned long randInit)
-    : SimulationNBodyInterface(nBodies, scheme, soft, randInit)
+    : SimulationNBodyInterface<T>(nBodies, scheme, soft, randInit), rsqrtIterations(0), compensated(false)
 {
     this->flopsPerIte = 30.f * ((float)this->getBodies().getN() * (float)this->getBodies().getN() - (float)this->getBodies().getN())/2;
-    this->accelerations.ax.resize(this->getBodies().getN() + this->getBodies().getPadding());
-    this->accelerations.ay.resize(this->getBodies().getN() + this->getBodies().getPadding());
-    this->accelerations.az.resize(this->getBodies().getN() + this->getBodies().getPadding());
 
+    // the padding bodies are massless and their accelerations are dropped
+    constexpr unsigned long B = SIMD_TILE_I * mipp::N<T>();
+    this->nPadded = (this->getBodies().getN() + B - 1) / B * B;
+    firstTouch(this->accelerations.ax, this->nPadded);
+    firstTouch(this->accelerations.ay, this->nPadded);
+    firstTouch(this->accelerations.az, this->nPadded);
+    this->paddedQx.resize(this->nPadded);
+    this->paddedQy.resize(this->nPadded);
+    this->paddedQz.resize(this->nPadded);
+    this->paddedM.resize(this->nPadded);
+    this->allocatedBytes += (this->nPadded - this->getBodies().getN()) * sizeof(T) * 3;
+    this->allocatedBytes += this->nPadded * sizeof(T) * 4;
+
+    this->threadAccelerations.resize(3 * this->nPadded * omp_get_max_threads());
+    this->allocatedBytes += 3 * this->nPadded * omp_get_max_threads() * sizeof(T);
 }
 
-void SimulationNBodySIMD_OMP::initIteration()
+template <typename T> void SimulationNBodySIMD_OMP<T>::initIteration()
 {
     std::fill(this->accelerations.ax.begin(),this->accelerations.ax.end(),0);
     std::fill(this->accelerations.ay.begin(),this->accelerations.ay.end(),0);
     std::fill(this->accelerations.az.begin(),this->accelerations.az.end(),0);
 }
 
+template <typename T> void SimulationNBodySIMD_OMP<T>::setRsqrtIterations(const unsigned rsqrtIterations)
+{
+    this->rsqrtIterations = std::min(rsqrtIterations, 2u);
+}
+
+template <typename T> void SimulationNBodySIMD_OMP<T>::setCompensated(const bool compensated)
+{
+    this->compensated = compensated;
+    if (compensated && this->threadAccelerations.size() < 6 * this->nPadded * omp_get_max_threads()) {
+        // emptied first so that nothing is copied: the fresh buffer is only written by the thread owning each part,
+        // when it zeroes it at the next iteration
+        this->allocatedBytes += 3 * this->nPadded * omp_get_max_threads() * sizeof(T);
+        this->threadAccelerations.clear();
+        this->threadAccelerations.resize(6 * this->nPadded * omp_get_max_threads());
+    }
+}
+
+template <typename T> void SimulationNBodySIMD_OMP<T>::computeBodiesAcceleration()
+{
+    switch (this->rsqrtIterations) {
+    case 0:
+        if (this->compensated)
+            this->template computeBodiesAccelerationTiles<0, true>();
+        else
+            this->template computeBodiesAccelerationTiles<0, false>();
+        break;
+    case 1:
+        if (this->compensated)
+            this->template computeBodiesAccelerationTiles<1, true>();
+        else
+            this->template computeBodiesAccelerationTiles<1, false>();
+        break;
+    default:
+        if (this->compensated)
+            this->template computeBodiesAccelerationTiles<2, true>();
+        else
+            this->template computeBodiesAccelerationTiles<2, false>();
+    }
+}
+
+//Third version
+template <typename T>
+template <int NR, bool KAHAN>
+void SimulationNBodySIMD_OMP<T>::computeBodiesAccelerationTiles()
+{
+    const dataSoA_t<T> &d = this->getBodies().getDataSoA();
+    // compute e²
+    const T softSquared = std::pow(this->soft, 2); // 1 flops
+    const unsigned long n_bodies = this->getBodies().getN();
+    const unsigned long n_padded = this->nPadded;
+    constexpr int N = mipp::N<T>();
+    const mipp::Reg<T> softSquared_v = softSquared;
+    const mipp::Reg<T> G_v = this->G;
+
+    std::copy(d.qx.begin(), d.qx.begin() + n_bodies, this->paddedQx.begin());
+    std::copy(d.qy.begin(), d.qy.begin() + n_bodies, this->paddedQy.begin());
+    std::copy(d.qz.begin(), d.qz.begin() + n_bodies, this->paddedQz.begin());
+    std::copy(d.m.begin(), d.m.begin() + n_bodies, this->paddedM.begin());
+    // x, y and z, then their compensations
+    const unsigned long stride = (KAHAN ? 6 : 3) * n_padded;
+    if (this->threadAccelerations.size() < stride * omp_get_max_threads()) { // the thread count grew, see `setCompensated`
+        this->threadAccelerations.clear();
+        this->threadAccelerations.resize(stride * omp_get_max_threads());
+    }
+
+    // The tiles write the accelerations of the bodies after them, which belong to the tiles of other threads: each
+    // thread accumulates in its own buffer, and the buffers are summed at the end. The tiles get shorter and shorter,
+    // hence the dynamic schedule.
+    const long n_tiles = n_padded / (SIMD_TILE_I * N);
+    #pragma omp parallel
+    {
+        T *acc = &this->threadAccelerations[stride * omp_get_thread_num()];
+        std::fill(acc, acc + stride, (T)0);
+
+        #pragma omp for schedule(dynamic)
+        for (long t = 0; t < n_tiles; t++)
+            computeSymmetricTileSIMD<T, SIMD_TILE_I, SIMD_TILE_J, NR, KAHAN>(
+                this->paddedQx.data(), this->paddedQy.data(), this->paddedQz.data(), this->paddedM.data(),
+                t * SIMD_TILE_I * N, n_padded, softSquared_v, G_v, acc, acc + n_padded, acc + 2 * n_padded,
+                acc + 3 * n_padded, acc + 4 * n_padded, acc + 5 * n_padded);
+
+        // the buffers of the threads are summed in double precision
+        const int n_threads = omp_get_num_threads();
+        #pragma omp for
+        for (unsigned long b = 0; b < n_bodies; b++) {
+            double ax = 0, ay = 0, az = 0;
+            for (int th = 0; th < n_threads; th++) {
+                const T *other = &this->threadAccelerations[stride * th];
+                ax += other[b];
+                ay += other[n_padded + b];
+                az += other[2 * n_padded + b];
+                if (KAHAN) {
+                    ax -= other[3 * n_padded + b];
+                    ay -= other[4 * n_padded + b];
+                    az -= other[5 * n_padded + b];
+                }
+            }
+            this->accelerations.ax[b] = ax;
+            this->accelerations.ay[b] = ay;
+            this->accelerations.az[b] = az;
+        }
+    }
+}
+
+
+/*
 //Second version
 void SimulationNBodySIMD_OMP::computeBodiesAcceleration()
 {
@@ -57,44 +179,9 @@ void SimulationNBodySIMD_OMP::computeBodiesAcceleration()
         mipp::Reg<float> ay = 0.0;
         mipp::Reg<float> az = 0.0;
 
-        for (jBody = 0; jBody < n_bodies; jBody += 1) {
-            mipp::Reg<float> j_qx = d.qx[jBody]; //We duplicate : the same j for multiple i.
-            mipp::Reg<float> rijx = j_qx - i_qx;
-
-            mipp::Reg<float> j_qy = d.qy[jBody];
-            mipp::Reg<float> rijy = j_qy - i_qy;
-
-            mipp::Reg<float> j_qz = d.qz[jBody];
-            mipp::Reg<float> rijz = j_qz - i_qz;
-
-            mipp::Reg<float> rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
-            // mipp::Reg<float> rijSquared = rijx * rijx;  //fma doesn't seem to add to perf
-            // rijSquared = mipp::fmadd(rijy,rijy,rijSquared);
-            // rijSquared = mipp::fmadd(rijz,rijz,rijSquared);
-
-
-
-            mipp::Reg<float> x = G_v / ((rijSquared + softSquared_v) * mipp::sqrt(rijSquared + softSquared_v));
-            mipp::Reg<float> j_m = d.m[jBody];
-            mipp::Reg<float> ai = x * j_m; // 1 flops
-
-
-            mipp::Reg<float> i_ax = ai * rijx;
-            ax += i_ax;
-            mipp::Reg<float> i_ay = ai * rijy;
-            ay += i_ay;
-            mipp::Reg<float> i_az = ai * rijz;
-            az += i_az;
-
-
-            // mipp::Reg<float> aj = x * i_m; // 1 flops
-
-
-            // mipp::Reg<float> j_ax = aj * rijx;
-            // mipp::Reg<float> j_ay = aj * rijy;
-            // mipp::Reg<float> j_az = aj * rijz;
-
-        }
+        for (jBody = 0; jBody < n_bodies; jBody += 1)
+            accumulateAccelerationSIMD(i_qx, i_qy, i_qz, d.qx[jBody], d.qy[jBody], d.qz[jBody], d.m[jBody],
+                                       softSquared_v, G_v, ax, ay, az);
         
 
         ax.store(&this->accelerations.ax[iBody]);
@@ -106,6 +193,9 @@ void SimulationNBodySIMD_OMP::computeBodiesAcceleration()
 }
 
 
+*/
+
+
 /*
 //First version
 void SimulationNBodySIMD_OMP::computeBodiesAcceleration()
@@ -195,10 +285,15 @@ void SimulationNBodySIMD_OMP::computeBodiesAcceleration()
 }
 */
 
-void SimulationNBodySIMD_OMP::computeOneIteration()
+template <typename T> void SimulationNBodySIMD_OMP<T>::computeOneIteration()
 {
     this->initIteration();
     this->computeBodiesAcceleration();
     // time integration
     this->bodies.updatePositionsAndVelocities(this->accelerations, this->dt);
 }
+
+// ==================================================================================== explicit template instantiation
+template class SimulationNBodySIMD_OMP<double>;
+template class SimulationNBodySIMD_OMP<float>;
+// ==================================================================================== explicit template instantiation
@@ -3,21 +3,37 @@
 
 #include <string>
 
+#include "mipp.h"
+
 #include "core/SimulationNBodyInterface.hpp"
 
-class SimulationNBodySIMD_OMP : public SimulationNBodyInterface {
+template <typename T> class SimulationNBodySIMD_OMP : public SimulationNBodyInterface<T> {
   protected:
-    accSoA_t<float> accelerations;
+    accSoA_t<T> accelerations;          /*!< Accelerations of the bodies, padded like the positions. */
+    unsigned rsqrtIterations;           /*!< Newton-Raphson iterations refining the hardware rsqrt (0 for the exact
+                                             division and square root). */
+    bool compensated;                   /*!< Accumulate the accelerations with the compensated (Kahan) summation. */
+    unsigned long nPadded;              /*!< Number of bodies rounded up to a whole number of tiles. */
+    mipp::vector<T> paddedQx;           /*!< Positions and masses of the bodies, padded with massless bodies. */
+    mipp::vector<T> paddedQy;
+    mipp::vector<T> paddedQz;
+    mipp::vector<T> paddedM;
+    soaArray_t<T> threadAccelerations;  /*!< Accelerations accumulated by each thread, x, y then z (then their
+                                             compensations, when `compensated`), placed by the thread that zeroes
+                                             it. */
 
   public:
-    SimulationNBodySIMD_OMP(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
+    SimulationNBodySIMD_OMP(const unsigned long nBodies, const std::string &scheme = "galaxy", const T soft = 0.035f,
                          const unsigned long randInit = 0);
     virtual ~SimulationNBodySIMD_OMP() = default;
     virtual void computeOneIteration();
+    void setRsqrtIterations(const unsigned rsqrtIterations);
+    void setCompensated(const bool compensated);
 
   protected:
     void initIteration();
     void computeBodiesAcceleration();
+    template <int NR, bool KAHAN> void computeBodiesAccelerationTiles();
 };
 
 #endif /* SIMULATION_N_BODY_OPTIM_HPP_ */
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include <omp.h>
+
+#include "SimulationNBodyTreePM.hpp"
+
+SimulationNBodyTreePM::SimulationNBodyTreePM(const unsigned long nBodies, const std::string &scheme, const float soft,
+                                             const unsigned long randInit)
+    : SimulationNBodyBarnesHutOMP(nBodies, scheme, soft, randInit), mesh(G, soft)
+{
+    this->mesh.setSplitCells(TREEPM_SPLIT);
+    this->allocatedBytes += this->mesh.getAllocatedBytes();
+
+    // one more sample past the cutoff for the interpolation, the factor is taken as 0 from there
+    const double pi = std::acos(-1.0);
+    this->shortRange.resize(TREEPM_TABLE_SIZE + 2);
+    for (unsigned k = 0; k <= TREEPM_TABLE_SIZE; k++) {
+        const double u = (double)k * TREEPM_CUTOFF / TREEPM_TABLE_SIZE;
+        this->shortRange[k] = std::erfc(u / 2) + u / std::sqrt(pi) * std::exp(-u * u / 4);
+    }
+    this->shortRange[TREEPM_TABLE_SIZE + 1] = 0.f;
+    this->allocatedBytes += this->shortRange.size() * sizeof(float);
+}
+
+void SimulationNBodyTreePM::setGridSize(const unsigned gridSize)
+{
+    this->allocatedBytes += this->mesh.setGridSize(gridSize);
+}
+
+bool SimulationNBodyTreePM::setQuadrupole(const bool quadrupole)
+{
+    // the short range walk only scales the monopoles, the moments would be computed for nothing
+    if (quadrupole)
+        return false;
+    return SimulationNBodyBarnesHutOMP::setQuadrupole(quadrupole);
+}
+
+unsigned long SimulationNBodyTreePM::getNodeBytes() const
+{
+    return SimulationNBodyBarnesHutOMP::getNodeBytes() + this->reachSquared.capacity() * sizeof(float);
+}
+
+unsigned SimulationNBodyTreePM::computeShortRangeAcceleration(const dataAoS_t<float> *body, float *ax, float *ay,
+                                                              float *az)
+{
+    // Same walk as `computeBodyAcceleration`, except that the cells out of reach of the cutoff are skipped whatever
+    // their size, and that every term is scaled by the short range factor.
+    const FlatNode *nodes = this->flatTree.data();
+    const unsigned n_nodes = this->flatTree.size();
+    const float theta = this->theta;
+    const float *table = this->shortRange.data();
+    const float toTable = TREEPM_TABLE_SIZE / (TREEPM_CUTOFF * this->mesh.getSplitRadius());
+    float aix = *ax, aiy = *ay, aiz = *az;
+
+    unsigned i = 0, cost = 0;
+    while (i < n_nodes) {
+        const FlatNode &node = nodes[i];
+        cost++;
+        const float rijx = node.CoMx - body->qx;
+        const float rijy = node.CoMy - body->qy;
+        const float rijz = node.CoMz - body->qz;
+        const float rijSquared = rijx * rijx + rijy * rijy + rijz * rijz;
+
+        if (rijSquared > this->reachSquared[i]) {
+            i = node.next;
+        } else if (node.sizeSquared / rijSquared <= theta * theta) {
+            const float r = std::sqrt(rijSquared + softSquared);
+            const float t = std::min(r * toTable, (float)TREEPM_TABLE_SIZE + 1);
+            const unsigned k = std::min((unsigned)t, (unsigned)TREEPM_TABLE_SIZE);
+            const float factor = table[k] + (t - k) * (table[k + 1] - table[k]);
+            const float x = this->G / ((rijSquared + softSquared) * r);
+            const float ai = x * node.mass * factor;
+            aix += ai * rijx;
+            aiy += ai * rijy;
+            aiz += ai * rijz;
+            i = node.next;
+        } else if (node.next == i + 1) {
+            const unsigned end = node.first + node.count;
+            cost += node.count;
+            for (unsigned j=node.first;j<end;j++) {
+                const float rjx = this->leafQx[j] - body->qx;
+                const float rjy = this->leafQy[j] - body->qy;
+                const float rjz = this->leafQz[j] - body->qz;
+                const float rjSquared = rjx * rjx + rjy * rjy + rjz * rjz;
+                const float r = std::sqrt(rjSquared + softSquared);
+                const float t = std::min(r * toTable, (float)TREEPM_TABLE_SIZE + 1);
+                const unsigned k = std::min((unsigned)t, (unsigned)TREEPM_TABLE_SIZE);
+                const float factor = table[k] + (t - k) * (table[k + 1] - table[k]);
+                const float x = this->G / ((rjSquared + softSquared) * r);
+                const float aj = x * this->leafM[j] * factor;
+                aix += aj * rjx;
+                aiy += aj * rjy;
+                aiz += aj * rjz;
+            }
+            i = node.next;
+        } else {
+            i++;
+        }
+    }
+
+    *ax = aix;
+    *ay = aiy;
+    *az = aiz;
+    return cost;
+}
+
+void SimulationNBodyTreePM::computeBodiesAcceleration()
+{
+    // the mesh goes first: it places itself around the bodies, which sets the split radius of the walk
+    this->mesh.computeAccelerations(this->getBodies(), this->accelerations);
+
+    // the center of mass lies in the cell, whose bodies are at most its diagonal away from it, and the cutoff applies
+    // to the softened distance
+    const float cutoff = TREEPM_CUTOFF * this->mesh.getSplitRadius();
+    const float distance = std::sqrt(std::max(cutoff * cutoff - this->softSquared, 0.f));
+    const long n_nodes = this->flatTree.size();
+    this->reachSquared.resize(n_nodes);
+    #pragma omp parallel for
+    for (long i = 0; i < n_nodes; i++) {
+        const float reach = distance + std::sqrt(3.f * this->flatTree[i].sizeSquared);
+        this->reachSquared[i] = reach * reach;
+    }
+
+    const std::vector<dataAoS_t<float>> &d = this->getBodies().getDataAoS();
+    const unsigned n_zones = omp_get_max_threads();
+    this->computeCostZones(n_zones);
+    #pragma omp parallel for schedule(static, 1)
+    for (unsigned z = 0; z < n_zones; z++) {
+        for (unsigned long i = this->zoneStart[z]; i < this->zoneStart[z + 1]; i++) {
+            const unsigned iBody = this->leafBodies[i];
+            this->bodyCost[iBody] = this->computeShortRangeAcceleration(&d[iBody], &this->accelerations[iBody].ax,
+                                                                        &this->accelerations[iBody].ay,
+                                                                        &this->accelerations[iBody].az);
+        }
+    }
+}
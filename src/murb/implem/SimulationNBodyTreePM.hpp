@@ -0,0 +1,47 @@
+#ifndef SIMULATION_N_BODY_TREE_PM_HPP_
+#define SIMULATION_N_BODY_TREE_PM_HPP_
+
+#include <string>
+#include <vector>
+
+#include "core/SimulationNBodyInterface.hpp"
+#include "SimulationNBodyBarnesHutOMP.hpp"
+#include "ParticleMesh.hpp"
+#include "core/Bodies.hpp"
+
+#define TREEPM_SPLIT 1.25f      // split radius r_s between the mesh and the tree, in mesh cells
+#define TREEPM_CUTOFF 6.f       // the tree ignores what is further than TREEPM_CUTOFF * r_s, where the short range
+                                // force has fallen under 1e-3 of the Newtonian one
+#define TREEPM_TABLE_SIZE 1024  // samples of the short range factor between 0 and the cutoff
+
+/*!
+ * \class  SimulationNBodyTreePM
+ * \brief  TreePM: long range gravity on the mesh of `ParticleMesh`, short range gravity with the Barnes-Hut tree.
+ *
+ * The softened potential is split at r_s into erf(r / 2r_s) / r, smooth and solved on the mesh, and erfc(r / 2r_s) / r,
+ * which vanishes after a few r_s and is summed by the tree walk, with r = sqrt(d^2 + e^2) the softened distance. The
+ * walk skips every cell beyond the cutoff and scales the softened Newtonian force of the others by the factor
+ * erfc(r / 2r_s) + r / (r_s.sqrt(pi)) exp(-r^2 / 4r_s^2), read from a table. A body only opens the cells around it,
+ * so the cost of a step hardly depends on how clustered the bodies are.
+ */
+class SimulationNBodyTreePM : public SimulationNBodyBarnesHutOMP {
+  protected:
+    ParticleMesh mesh;                  /*!< Long range solver. */
+    std::vector<float> shortRange;      /*!< Short range factor at TREEPM_TABLE_SIZE + 2 evenly spaced r / r_s. */
+    std::vector<float> reachSquared;    /*!< Squared distance from the center of mass of each flat node beyond which
+                                             none of its bodies is within the (softened) cutoff. */
+
+  public:
+    SimulationNBodyTreePM(const unsigned long nBodies, const std::string &scheme = "galaxy", const float soft = 0.035f,
+                          const unsigned long randInit = 0);
+    virtual ~SimulationNBodyTreePM() = default;
+    void setGridSize(const unsigned gridSize);
+    bool setQuadrupole(const bool quadrupole) override;
+
+  protected:
+    void computeBodiesAcceleration() override;
+    unsigned long getNodeBytes() const override;
+    unsigned computeShortRangeAcceleration(const dataAoS_t<float> *body, float *ax, float *ay, float *az);
+};
+
+#endif /* SIMULATION_N_BODY_TREE_PM_HPP_ */
@@ -15,6 +15,7 @@
 #endif
 
 #include "core/Bodies.hpp"
+#include "utils/Affinity.hpp"
 #include "utils/ArgumentsReader.hpp"
 #include "utils/Perf.hpp"
 
@@ -26,6 +27,10 @@
 #include "implem/SimulationNBodySIMDPThread.hpp"
 #include "implem/SimulationNBodyBarnesHut.hpp"
 #include "implem/SimulationNBodyBarnesHutOMP.hpp"
+#include "implem/SimulationNBodyBarnesHutSIMD.hpp"
+#include "implem/SimulationNBodyFMM.hpp"
+#include "implem/SimulationNBodyPM.hpp"
+#include "implem/SimulationNBodyTreePM.hpp"
 
 
 /* global variables */
@@ -44,6 +49,22 @@ unsigned int WinHeight = 768;        /*!< Window height for visualization. */
 unsigned int LocalWGSize = 32;       /*!< OpenCL local workgroup size. */
 std::string BodiesScheme = "galaxy"; /*!< Initial condition of the bodies. */
 bool ShowGFlops = false;             /*!< Display the GFlop/s. */
+bool MortonBuild = false;            /*!< Build the Barnes-Hut octree from sorted Morton keys. */
+bool QuadrupoleMoments = false;      /*!< Add the quadrupole moments of the cells to the Barnes-Hut walk. */
+bool DualTree = false;               /*!< Walk the Barnes-Hut octree once per pair of cells instead of once per body. */
+float Theta = 0.f;                   /*!< Opening angle of the Barnes-Hut walk (0 for the default). */
+float ThetaTarget = 0.f;             /*!< Relative acceleration error targeted by the opening angle tuner (0 to disable it). */
+unsigned int BucketSize = 0;         /*!< Maximum number of bodies in a Barnes-Hut leaf (0 for the default). */
+float RefitTolerance = 0.f;          /*!< Node count growth tolerated by the Barnes-Hut refit (0 to disable it). */
+unsigned int FMMOrder = 4;           /*!< Order of the FMM expansions. */
+unsigned int GridSize = PM_GRID_SIZE; /*!< Number of cells per dimension of the particle-mesh grid. */
+unsigned int ReorderPeriod = 0;      /*!< Iterations between two Morton reorderings of the bodies (0 to disable it). */
+unsigned int RsqrtIterations = 0;    /*!< Newton-Raphson iterations of the fast SIMD kernels (0 to disable them). */
+bool Compensated = false;            /*!< Accumulate the accelerations of the SIMD kernels with the Kahan summation. */
+unsigned int PoolThreads = 0;        /*!< Number of threads of the POSIX thread pool (0 for the number of cores). */
+std::string Affinity = "none";       /*!< Policy pinning the threads to the cores ("compact" or "scatter"). */
+std::vector<int> AffinityCores;      /*!< Cores of the threads, in the order of the threads (empty to not pin them). */
+bool Fp64 = false;                   /*!< Compute in double precision (direct implementations only). */
 
 /*!
  * \fn     void argsReader(int argc, char** argv)
@@ -89,6 +110,10 @@ void argsReader(int argc, char **argv)
                      "\t\t\t - \"cpu+simd+omp\"\n"
                      "\t\t\t - \"cpu+barnesHut\"\n"
                      "\t\t\t - \"cpu+barnesHut+omp\"\n"
+                     "\t\t\t - \"cpu+barnesHut+simd\"\n"
+                     "\t\t\t - \"cpu+fmm\"\n"
+                     "\t\t\t - \"cpu+pm\"\n"
+                     "\t\t\t - \"cpu+treepm\"\n"
                      "\t\t\t ----";
     faculArgs["-soft"] = "softeningFactor";
     docArgs["-soft"] = "softening factor.";
@@ -100,6 +125,52 @@ void argsReader(int argc, char **argv)
     docArgs["s"] = "bodies scheme (initial conditions can be \"galaxy\" or \"galaxy2\" or \"random\").";
     faculArgs["-gf"] = "";
     docArgs["-gf"] = "display the number of GFlop/s.";
+    faculArgs["-morton"] = "";
+    docArgs["-morton"] = "build the Barnes-Hut octree from radix sorted Morton keys instead of by insertion.";
+    faculArgs["-quadrupole"] = "";
+    docArgs["-quadrupole"] = "add the quadrupole moments of the cells to the Barnes-Hut walk, which opens fewer cells "
+                             "(not with cpu+treepm).";
+    faculArgs["-dual-tree"] = "";
+    docArgs["-dual-tree"] = "make the Barnes-Hut cells interact pairwise and push the result down to their bodies "
+                            "(cpu+barnesHut and cpu+barnesHut+omp, without --quadrupole).";
+    faculArgs["-theta"] = "theta";
+    docArgs["-theta"] = "opening angle of the Barnes-Hut walk (default is " + std::to_string(THETA) + ", " +
+                        std::to_string(QUADRUPOLE_THETA) + " with --quadrupole).";
+    faculArgs["-theta-target"] = "error";
+    docArgs["-theta-target"] = "tune the opening angle of the Barnes-Hut walk every " +
+                               std::to_string(THETA_TUNING_PERIOD) + " iterations, to the largest one that keeps the "
+                               "relative error of the accelerations of a sample of bodies below this value (e.g. 1e-3, not with "
+                               "cpu+fmm and cpu+treepm).";
+    faculArgs["-bucket"] = "bucketSize";
+    docArgs["-bucket"] = "maximum number of bodies in a Barnes-Hut leaf (default is 8, " +
+                         std::to_string(DUAL_TREE_BUCKET_SIZE) + " with --dual-tree, " +
+                         std::to_string(FMM_BUCKET_SIZE) + " for cpu+fmm).";
+    faculArgs["-order"] = "FMMOrder";
+    docArgs["-order"] = "order of the FMM expansions, from 1 to " + std::to_string(FMM_MAX_ORDER) + " (default is " +
+                        std::to_string(FMMOrder) + ").";
+    faculArgs["-grid"] = "gridSize";
+    docArgs["-grid"] = "number of cells per dimension of the particle-mesh grid, rounded up to a power of 2 (default is " +
+                       std::to_string(GridSize) + ").";
+    faculArgs["-refit"] = "tolerance";
+    docArgs["-refit"] = "keep the Barnes-Hut octree between iterations and only move the bodies that left their leaf, "
+                        "until the tree has grown by more than this fraction of its nodes (e.g. 0.1).";
+    faculArgs["-reorder"] = "period";
+    docArgs["-reorder"] = "sort the bodies in memory along a Morton curve every `period` iterations, for every "
+                          "implementation (e.g. 10).";
+    faculArgs["-rsqrt"] = "iterations";
+    docArgs["-rsqrt"] = "replace the division and the square root of the direct SIMD kernels (cpu+simd and "
+                        "cpu+simd+omp) by the hardware rsqrt refined by 1 or 2 Newton-Raphson iterations.";
+    faculArgs["-kahan"] = "";
+    docArgs["-kahan"] = "accumulate the accelerations of the direct SIMD kernels (cpu+simd and cpu+simd+omp) with the "
+                        "compensated (Kahan) summation, whose error does not grow with the number of bodies.";
+    faculArgs["-threads"] = "nThreads";
+    docArgs["-threads"] = "number of threads of the thread pool of cpu+simd+pthread (default is the number of cores).";
+    faculArgs["-affinity"] = "policy";
+    docArgs["-affinity"] = "pin the threads to the cores before the bodies are allocated, \"compact\" fills a socket "
+                           "before the next one and \"scatter\" alternates between the sockets.";
+    faculArgs["-fp64"] = "";
+    docArgs["-fp64"] = "compute in double precision (cpu+naive, cpu+optim, cpu+omp, cpu+simd, cpu+simd+omp and "
+                        "cpu+simd+pthread).";
 
     if (argsReader.parse_arguments(reqArgs, faculArgs)) {
         NBodies = stoi(argsReader.get_argument("n"));
@@ -152,6 +223,83 @@ void argsReader(int argc, char **argv)
         BodiesScheme = argsReader.get_argument("s");
     if (argsReader.exist_argument("-gf"))
         ShowGFlops = true;
+    if (argsReader.exist_argument("-morton"))
+        MortonBuild = true;
+    if (argsReader.exist_argument("-quadrupole"))
+        QuadrupoleMoments = true;
+    if (argsReader.exist_argument("-order")) {
+        FMMOrder = stoi(argsReader.get_argument("-order"));
+        if (FMMOrder < 1 || FMMOrder > FMM_MAX_ORDER) {
+            std::cout << "FMM order must be between 1 and " << FMM_MAX_ORDER << "... exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-grid")) {
+        GridSize = stoi(argsReader.get_argument("-grid"));
+        if (GridSize == 0) {
+            std::cout << "Grid size can't be equal to 0... exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-refit"))
+        RefitTolerance = stof(argsReader.get_argument("-refit"));
+    if (argsReader.exist_argument("-reorder"))
+        ReorderPeriod = stoi(argsReader.get_argument("-reorder"));
+    if (argsReader.exist_argument("-rsqrt")) {
+        RsqrtIterations = stoi(argsReader.get_argument("-rsqrt"));
+        if (RsqrtIterations < 1 || RsqrtIterations > 2) {
+            std::cout << "Number of Newton-Raphson iterations must be 1 or 2... exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-kahan"))
+        Compensated = true;
+    if (argsReader.exist_argument("-threads")) {
+        PoolThreads = stoi(argsReader.get_argument("-threads"));
+        if (PoolThreads == 0) {
+            std::cout << "Number of threads can't be equal to 0... exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-affinity")) {
+        Affinity = argsReader.get_argument("-affinity");
+        AffinityCores = getAffinityCores(Affinity);
+        if (AffinityCores.empty()) {
+            std::cout << "Affinity must be \"compact\" or \"scatter\"... exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-fp64"))
+        Fp64 = true;
+    if (argsReader.exist_argument("-dual-tree")) {
+        DualTree = true;
+        if (QuadrupoleMoments) {
+            std::cout << "The dual tree traversal only uses the monopoles, it can't be combined with --quadrupole... "
+                         "exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-theta")) {
+        Theta = stof(argsReader.get_argument("-theta"));
+        if (Theta <= 0.f) {
+            std::cout << "Opening angle has to be greater than 0... exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-theta-target")) {
+        ThetaTarget = stof(argsReader.get_argument("-theta-target"));
+        if (ThetaTarget <= 0.f) {
+            std::cout << "Targeted error has to be greater than 0... exiting." << std::endl;
+            exit(-1);
+        }
+    }
+    if (argsReader.exist_argument("-bucket")) {
+        BucketSize = stoi(argsReader.get_argument("-bucket"));
+        if (BucketSize == 0) {
+            std::cout << "Bucket size can't be equal to 0... exiting." << std::endl;
+            exit(-1);
+        }
+    }
 }
 
 /*!
@@ -187,30 +335,112 @@ std::string strDate(float timestamp)
 }
 
 /*!
- * \fn     SimulationNBodyInterface *createImplem()
- * \brief  Select and allocate an n-body simulation object.
+ * \fn     SimulationNBodyBarnesHut *setBarnesHutOptions(SimulationNBodyBarnesHut *simu)
+ * \brief  Forward the Barnes-Hut specific command line options to a tree-based simulation.
  *
- * \return A fresh allocated simulation.
+ * \param  simu : The simulation to configure.
+ *
+ * \return The configured simulation.
  */
-SimulationNBodyInterface *createImplem()
+SimulationNBodyBarnesHut *setBarnesHutOptions(SimulationNBodyBarnesHut *simu)
 {
-    SimulationNBodyInterface *simu = nullptr;
+    simu->setMortonBuild(MortonBuild);
+    simu->setQuadrupole(QuadrupoleMoments);
+    if (Theta > 0.f)
+        simu->setTheta(Theta);
+    simu->setThetaTarget(ThetaTarget);
+    if (BucketSize)
+        simu->setBucketSize(BucketSize);
+    simu->setRefitTolerance(RefitTolerance);
+    return simu;
+}
+
+/*!
+ * \fn     SimulationNBodyInterface<T> *createDirectImplem()
+ * \brief  Select and allocate a direct n-body simulation object, in single or double precision.
+ *
+ * \return A fresh allocated simulation, nullptr if `ImplTag` is not a direct implementation.
+ */
+template <typename T> SimulationNBodyInterface<T> *createDirectImplem()
+{
+    SimulationNBodyInterface<T> *simu = nullptr;
     if (ImplTag == "cpu+naive") {
-        simu = new SimulationNBodyNaive(NBodies, BodiesScheme, Softening);
+        simu = new SimulationNBodyNaive<T>(NBodies, BodiesScheme, Softening);
     } else if (ImplTag == "cpu+optim") {
-        simu = new SimulationNBodyOptim(NBodies, BodiesScheme, Softening);
+        simu = new SimulationNBodyOptim<T>(NBodies, BodiesScheme, Softening);
     } else if (ImplTag == "cpu+simd") {
-        simu = new SimulationNBodySIMD(NBodies, BodiesScheme, Softening);
+        SimulationNBodySIMD<T> *simd = new SimulationNBodySIMD<T>(NBodies, BodiesScheme, Softening);
+        simd->setRsqrtIterations(RsqrtIterations);
+        simd->setCompensated(Compensated);
+        simu = simd;
     } else if (ImplTag == "cpu+omp") {
-        simu = new SimulationNBodyOMP(NBodies, BodiesScheme, Softening);
+        simu = new SimulationNBodyOMP<T>(NBodies, BodiesScheme, Softening);
     } else if (ImplTag == "cpu+simd+omp") {
-        simu = new SimulationNBodySIMD_OMP(NBodies, BodiesScheme, Softening);
+        SimulationNBodySIMD_OMP<T> *simd = new SimulationNBodySIMD_OMP<T>(NBodies, BodiesScheme, Softening);
+        simd->setRsqrtIterations(RsqrtIterations);
+        simd->setCompensated(Compensated);
+        simu = simd;
     } else if (ImplTag == "cpu+simd+pthread") {
-        simu = new SimulationNBodySIMDPThread(NBodies, BodiesScheme, Softening);
-    } else if (ImplTag == "cpu+barnesHut") {
-        simu = new SimulationNBodyBarnesHut(NBodies, BodiesScheme, Softening);
-    } else if (ImplTag == "cpu+barnesHut+omp") {
-        simu = new SimulationNBodyBarnesHutOMP(NBodies, BodiesScheme, Softening);
+        SimulationNBodySIMDPThread<T> *pthread = new SimulationNBodySIMDPThread<T>(NBodies, BodiesScheme, Softening);
+        if (PoolThreads)
+            pthread->setThreads(PoolThreads);
+        pthread->setAffinity(AffinityCores);
+        simu = pthread;
+    }
+    return simu;
+}
+
+/*!
+ * \fn     SimulationNBodyInterface<float> *createImplem()
+ * \brief  Select and allocate an n-body simulation object.
+ *
+ * \return A fresh allocated simulation.
+ */
+SimulationNBodyInterface<float> *createImplem()
+{
+    SimulationNBodyInterface<float> *simu = createDirectImplem<float>();
+    if (simu != nullptr) {
+        return simu;
+    } else if (ImplTag == "cpu+barnesHut" || ImplTag == "cpu+barnesHut+omp") {
+        SimulationNBodyBarnesHut *tree;
+        if (ImplTag == "cpu+barnesHut")
+            tree = new SimulationNBodyBarnesHut(NBodies, BodiesScheme, Softening);
+        else
+            tree = new SimulationNBodyBarnesHutOMP(NBodies, BodiesScheme, Softening);
+        // before the other options, so that --bucket overrides the leaf size of the traversal
+        tree->setDualTree(DualTree);
+        simu = setBarnesHutOptions(tree);
+    } else if (ImplTag == "cpu+barnesHut+simd") {
+        simu = setBarnesHutOptions(new SimulationNBodyBarnesHutSIMD(NBodies, BodiesScheme, Softening));
+    } else if (ImplTag == "cpu+fmm") {
+        if (ThetaTarget > 0.f) { // the expansions are accepted with the fixed FMM_THETA
+            std::cout << "Implementation '" << ImplTag << "' does not support --theta-target... Exiting." << std::endl;
+            exit(-1);
+        }
+        SimulationNBodyFMM *fmm = new SimulationNBodyFMM(NBodies, BodiesScheme, Softening);
+        fmm->setOrder(FMMOrder);
+        // the expansions replace the monopoles and the opening angle of the walk, only the tree options apply
+        fmm->setMortonBuild(MortonBuild);
+        if (BucketSize)
+            fmm->setBucketSize(BucketSize);
+        fmm->setRefitTolerance(RefitTolerance);
+        simu = fmm;
+    } else if (ImplTag == "cpu+pm") {
+        SimulationNBodyPM *pm = new SimulationNBodyPM(NBodies, BodiesScheme, Softening);
+        pm->setGridSize(GridSize);
+        simu = pm;
+    } else if (ImplTag == "cpu+treepm") {
+        if (ThetaTarget > 0.f) { // the tuner measures the Newtonian walk, not the short range one
+            std::cout << "Implementation '" << ImplTag << "' does not support --theta-target... Exiting." << std::endl;
+            exit(-1);
+        }
+        if (QuadrupoleMoments) { // the short range walk only uses the monopoles
+            std::cout << "Implementation '" << ImplTag << "' does not support --quadrupole... Exiting." << std::endl;
+            exit(-1);
+        }
+        SimulationNBodyTreePM *treePM = new SimulationNBodyTreePM(NBodies, BodiesScheme, Softening);
+        treePM->setGridSize(GridSize);
+        simu = setBarnesHutOptions(treePM);
     } else {
         std::cout << "Implementation '" << ImplTag << "' does not exist... Exiting." << std::endl;
         exit(-1);
@@ -218,50 +448,52 @@ SimulationNBodyInterface *createImplem()
     return simu;
 }
 
-SpheresVisu *createVisu(SimulationNBodyInterface *simu)
+template <typename T> SpheresVisu *createVisu(SimulationNBodyInterface<T> *simu)
 {
     SpheresVisu *visu;
 
 #ifdef VISU
     if (VisuEnable) {
-        const float *positionsX = simu->getBodies().getDataSoA().qx.data();
-        const float *positionsY = simu->getBodies().getDataSoA().qy.data();
-        const float *positionsZ = simu->getBodies().getDataSoA().qz.data();
+        const T *positionsX = simu->getBodies().getDataSoA().qx.data();
+        const T *positionsY = simu->getBodies().getDataSoA().qy.data();
+        const T *positionsZ = simu->getBodies().getDataSoA().qz.data();
 
-        const float *velocitiesX = simu->getBodies().getDataSoA().vx.data();
-        const float *velocitiesY = simu->getBodies().getDataSoA().vy.data();
-        const float *velocitiesZ = simu->getBodies().getDataSoA().vz.data();
+        const T *velocitiesX = simu->getBodies().getDataSoA().vx.data();
+        const T *velocitiesY = simu->getBodies().getDataSoA().vy.data();
+        const T *velocitiesZ = simu->getBodies().getDataSoA().vz.data();
 
-        const float *radiuses = simu->getBodies().getDataSoA().r.data();
+        const T *radiuses = simu->getBodies().getDataSoA().r.data();
 
         if (GSEnable) // geometry shader = better performances on dedicated GPUs
-            visu = new OGLSpheresVisuGS<float>("MUrB n-body (geometry shader)", WinWidth, WinHeight, positionsX,
-                                               positionsY, positionsZ, velocitiesX, velocitiesY, velocitiesZ, radiuses,
-                                               NBodies, VisuColor);
+            visu = new OGLSpheresVisuGS<T>("MUrB n-body (geometry shader)", WinWidth, WinHeight, positionsX,
+                                           positionsY, positionsZ, velocitiesX, velocitiesY, velocitiesZ, radiuses,
+                                           NBodies, VisuColor);
         else
-            visu = new OGLSpheresVisuInst<float>("MUrB n-body (instancing)", WinWidth, WinHeight, positionsX,
-                                                 positionsY, positionsZ, velocitiesX, velocitiesY, velocitiesZ,
-                                                 radiuses, NBodies, VisuColor);
+            visu = new OGLSpheresVisuInst<T>("MUrB n-body (instancing)", WinWidth, WinHeight, positionsX,
+                                             positionsY, positionsZ, velocitiesX, velocitiesY, velocitiesZ,
+                                             radiuses, NBodies, VisuColor);
         std::cout << std::endl;
     }
     else
-        visu = new SpheresVisuNo<float>();
+        visu = new SpheresVisuNo<T>();
 #else
     VisuEnable = false;
-    visu = new SpheresVisuNo<float>();
+    visu = new SpheresVisuNo<T>();
 #endif
 
     return visu;
 }
 
-int main(int argc, char **argv)
+/*!
+ * \fn     int simulate(SimulationNBodyInterface<T> *simu)
+ * \brief  Display the configuration, run the iterations of a simulation and free it.
+ *
+ * \param  simu : The simulation to run.
+ *
+ * \return The exit status of the program.
+ */
+template <typename T> int simulate(SimulationNBodyInterface<T> *simu)
 {
-    // read arguments from the command line
-    // usage: ./nbody -n nBodies  -i nIterations [-v] [-w] ...
-    argsReader(argc, argv);
-
-    // create the n-body simulation
-    SimulationNBodyInterface *simu = createImplem();
     NBodies = simu->getBodies().getN();
 
     // get MB used for this simulation
@@ -275,7 +507,8 @@ int main(int argc, char **argv)
     std::cout << "  -> nb. of bodies     (-n    ): " << NBodies << std::endl;
     std::cout << "  -> nb. of iterations (-i    ): " << NIterations << std::endl;
     std::cout << "  -> verbose mode      (-v    ): " << ((Verbose) ? "enable" : "disable") << std::endl;
-    std::cout << "  -> precision                 : " << "fp32" << std::endl;
+    std::cout << "  -> precision                 : " << ((sizeof(T) == sizeof(double)) ? "fp64" : "fp32") << std::endl;
+    std::cout << "  -> thread affinity           : " << Affinity << std::endl;
     std::cout << "  -> mem. allocated            : " << Mbytes << " MB" << std::endl;
     std::cout << "  -> geometry shader   (--ngs ): " << ((GSEnable) ? "enable" : "disable") << std::endl;
     std::cout << "  -> time step         (--dt  ): " << std::to_string(Dt) + " sec" << std::endl;
@@ -286,6 +519,7 @@ int main(int argc, char **argv)
 
     // time step selection
     simu->setDt(Dt);
+    simu->setReorderPeriod(ReorderPeriod);
 
     std::cout << "Simulation started..." << std::endl;
 
@@ -330,6 +564,9 @@ int main(int argc, char **argv)
                << perfTotal.getGflops(simu->getFlopsPerIte() * (iIte - 1)) << " Gflop/s";
     std::cout << "Entire simulation took " << perfTotal.getElapsedTime() << " ms "
               << "(" << perfTotal.getFPS(iIte - 1) << " FPS" << gflops.str() << ")" << std::endl;
+    const SimulationNBodyBarnesHut *tree = dynamic_cast<const SimulationNBodyBarnesHut *>(simu);
+    if (tree != nullptr && ThetaTarget > 0.f)
+        std::cout << "Opening angle tuned to " << tree->getTheta() << std::endl;
 
     // free resources
     delete visu;
@@ -337,3 +574,28 @@ int main(int argc, char **argv)
 
     return EXIT_SUCCESS;
 }
+
+int main(int argc, char **argv)
+{
+    // read arguments from the command line
+    // usage: ./nbody -n nBodies  -i nIterations [-v] [-w] ...
+    argsReader(argc, argv);
+
+    // the threads are pinned before the bodies are allocated, for the first touch of their pages
+    pinOpenMPThreads(AffinityCores);
+
+    // create the n-body simulation
+    if (DualTree && ImplTag != "cpu+barnesHut" && ImplTag != "cpu+barnesHut+omp") {
+        std::cout << "Implementation '" << ImplTag << "' does not support --dual-tree... Exiting." << std::endl;
+        exit(-1);
+    }
+    if (Fp64) {
+        SimulationNBodyInterface<double> *simu = createDirectImplem<double>();
+        if (simu == nullptr) {
+            std::cout << "Implementation '" << ImplTag << "' does not support --fp64... Exiting." << std::endl;
+            exit(-1);
+        }
+        return simulate(simu);
+    }
+    return simulate(createImplem());
+}
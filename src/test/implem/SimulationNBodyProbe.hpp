@@ -0,0 +1,43 @@
+#ifndef SIMULATION_N_BODY_PROBE_HPP_
+#define SIMULATION_N_BODY_PROBE_HPP_
+
+#include <cmath>
+
+#include "SimulationNBodyOptim.hpp"
+
+/*!
+ * \class  SimulationNBodyProbe
+ * \brief  Gives access to the accelerations of the simulation S, computed from the current positions of the bodies.
+ */
+template <class S> class SimulationNBodyProbe : public S {
+  public:
+    using S::S;
+
+    void computeAccelerations()
+    {
+        this->initIteration();
+        this->computeBodiesAcceleration();
+    }
+
+    auto getAccelerations() const -> const decltype(this->accelerations) & { return this->accelerations; }
+};
+
+/*!
+ * \fn     double rmsAccelerationError(const SimulationNBodyProbe<S> &simuTest, const SimulationNBodyProbe<Optim> &simuRef)
+ * \brief  Root mean square of the relative error of the accelerations of a SoA simulation against a fp64 one.
+ */
+template <class S>
+double rmsAccelerationError(const SimulationNBodyProbe<S> &simuTest,
+                            const SimulationNBodyProbe<SimulationNBodyOptim<double>> &simuRef)
+{
+    const auto &acc = simuTest.getAccelerations();
+    double sum = 0;
+    for (unsigned long b = 0; b < simuRef.getBodies().getN(); b++) {
+        const accAoS_t<double> &ref = simuRef.getAccelerations()[b];
+        const double dx = acc.ax[b] - ref.ax, dy = acc.ay[b] - ref.ay, dz = acc.az[b] - ref.az;
+        sum += (dx * dx + dy * dy + dz * dz) / (ref.ax * ref.ax + ref.ay * ref.ay + ref.az * ref.az);
+    }
+    return std::sqrt(sum / simuRef.getBodies().getN());
+}
+
+#endif /* SIMULATION_N_BODY_PROBE_HPP_ */
@@ -10,13 +10,24 @@
 #include "SimulationNBodyBarnesHut.hpp"
 
 void test_nbody_barnes_hut(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
-                     const float eps)
+                     const float eps, const bool morton = false, const unsigned bucketSize = 8,
+                     const float refitTolerance = 0, const bool quadrupole = false, const float theta = 0,
+                     const float thetaTarget = 0, const bool dualTree = false)
 {
-    SimulationNBodyOptim simuRef(n, scheme, soft);
+    SimulationNBodyOptim<float> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
     SimulationNBodyBarnesHut simuTest(n, scheme, soft);
     simuTest.setDt(dt);
+    simuTest.setMortonBuild(morton);
+    simuTest.setBucketSize(bucketSize);
+    simuTest.setRefitTolerance(refitTolerance);
+    simuTest.setQuadrupole(quadrupole);
+    if (dualTree)
+        simuTest.setDualTree(true);
+    if (theta > 0)
+        simuTest.setTheta(theta);
+    simuTest.setThetaTarget(thetaTarget);
 
     const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
     const float *yRef = simuRef.getBodies().getDataSoA().qy.data();
@@ -58,3 +69,85 @@ TEST_CASE("n-body - BarnesHut", "[barnes_hut]")
     SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_barnes_hut(2048, 2e+08, 3600, 4, "galaxy", 1e-1); }
     SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
 }
+
+TEST_CASE("n-body - BarnesHut (Morton build)", "[barnes_hut_morton]")
+{
+    SECTION("fp32 - n=13 - i=1 - random") { test_nbody_barnes_hut(13, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_barnes_hut(13, 2e+08, 3600, 100, "random", 5e-3, true); }
+    SECTION("fp32 - n=16 - i=1 - random") { test_nbody_barnes_hut(16, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=128 - i=1 - random") { test_nbody_barnes_hut(128, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=2048 - i=1 - random") { test_nbody_barnes_hut(2048, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, true); }
+
+    SECTION("fp32 - n=13 - i=1 - galaxy") { test_nbody_barnes_hut(13, 2e+08, 3600, 1, "galaxy", 1e-1, true); }
+    SECTION("fp32 - n=13 - i=30 - galaxy") { test_nbody_barnes_hut(13, 2e+08, 3600, 30, "galaxy", 1e-1, true); }
+    SECTION("fp32 - n=16 - i=1 - galaxy") { test_nbody_barnes_hut(16, 2e+08, 3600, 1, "galaxy", 1e-2, true); }
+    SECTION("fp32 - n=128 - i=1 - galaxy") { test_nbody_barnes_hut(128, 2e+08, 3600, 1, "galaxy", 1e-2, true); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_barnes_hut(2048, 2e+08, 3600, 4, "galaxy", 1e-1, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true); }
+}
+
+TEST_CASE("n-body - BarnesHut (leaf buckets)", "[barnes_hut_buckets]")
+{
+    SECTION("fp32 - n=13 - i=1 - random - bucket=1") { test_nbody_barnes_hut(13, 2e+08, 3600, 1, "random", 1e-3, false, 1); }
+    SECTION("fp32 - n=2049 - i=3 - random - bucket=1") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, false, 1); }
+    SECTION("fp32 - n=2049 - i=3 - random - bucket=64") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, false, 64); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - bucket=1") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - bucket=64") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 64); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - Morton - bucket=1") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true, 1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - Morton - bucket=64") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true, 64); }
+}
+
+TEST_CASE("n-body - BarnesHut (refit)", "[barnes_hut_refit]")
+{
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_barnes_hut(13, 2e+08, 3600, 100, "random", 5e-3, false, 8, 0.1); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, false, 8, 0.1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0.1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - bucket=1") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 1, 0.1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - Morton") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true, 8, 0.1); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy - no rebuild") { test_nbody_barnes_hut(2048, 2e+08, 3600, 4, "galaxy", 1e-1, false, 8, 100); }
+}
+
+TEST_CASE("n-body - BarnesHut (quadrupole)", "[barnes_hut_quadrupole]")
+{
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_barnes_hut(13, 2e+08, 3600, 100, "random", 5e-3, false, 8, 0, true); }
+    SECTION("fp32 - n=2048 - i=1 - random") { test_nbody_barnes_hut(2048, 2e+08, 3600, 1, "random", 1e-3, false, 8, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, false, 8, 0, true); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_barnes_hut(2048, 2e+08, 3600, 4, "galaxy", 1e-1, false, 8, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - bucket=1") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 1, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - refit") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0.1, true); }
+}
+
+TEST_CASE("n-body - BarnesHut (opening angle)", "[barnes_hut_theta]")
+{
+    SECTION("fp32 - n=2049 - i=3 - random - theta=0.2") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, false, 8, 0, false, 0.2); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - theta=0.2") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0, false, 0.2); }
+    SECTION("fp32 - n=13 - i=100 - random - tuned") { test_nbody_barnes_hut(13, 2e+08, 3600, 100, "random", 5e-3, false, 8, 0, false, 0, 1e-3); }
+    SECTION("fp32 - n=2049 - i=3 - random - tuned") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, false, 8, 0, false, 0, 1e-3); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - tuned") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0, false, 0, 1e-3); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - quadrupole - tuned") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0, true, 0, 1e-3); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - dual tree - tuned") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0, false, 0, 1e-3, true); }
+}
+
+TEST_CASE("n-body - BarnesHut (dual tree)", "[barnes_hut_dual_tree]")
+{
+    SECTION("fp32 - n=13 - i=1 - random") { test_nbody_barnes_hut(13, 2e+08, 3600, 1, "random", 1e-3, false, 8, 0, false, 0, 0, true); }
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_barnes_hut(13, 2e+08, 3600, 100, "random", 5e-3, false, 8, 0, false, 0, 0, true); }
+    SECTION("fp32 - n=2048 - i=1 - random") { test_nbody_barnes_hut(2048, 2e+08, 3600, 1, "random", 1e-3, false, 8, 0, false, 0, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "random", 1e-3, false, 8, 0, false, 0, 0, true); }
+    SECTION("fp32 - n=13 - i=30 - galaxy") { test_nbody_barnes_hut(13, 2e+08, 3600, 30, "galaxy", 1e-1, false, 8, 0, false, 0, 0, true); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_barnes_hut(2048, 2e+08, 3600, 4, "galaxy", 1e-1, false, 8, 0, false, 0, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 8, 0, false, 0, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - Morton - refit") { test_nbody_barnes_hut(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true, 8, 0.1, false, 0, 0, true); }
+    SECTION("quadrupole refused") {
+        SimulationNBodyBarnesHut simu(13, "random", 2e+08);
+        REQUIRE(simu.setQuadrupole(true));
+        REQUIRE_FALSE(simu.setDualTree(true));
+        REQUIRE(simu.getTheta() == QUADRUPOLE_THETA);
+        REQUIRE(simu.setQuadrupole(false));
+        REQUIRE(simu.setDualTree(true));
+        REQUIRE_FALSE(simu.setQuadrupole(true));
+        REQUIRE(simu.getTheta() == THETA);
+    }
+}
@@ -10,13 +10,22 @@
 #include "SimulationNBodyBarnesHutOMP.hpp"
 
 void test_nbody_barnes_hut_omp(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
-                     const float eps)
+                     const float eps, const bool morton = false, const float refitTolerance = 0,
+                     const bool quadrupole = false, const bool dualTree = false, const unsigned reorderPeriod = 0,
+                     const float thetaTarget = 0)
 {
-    SimulationNBodyOptim simuRef(n, scheme, soft);
+    SimulationNBodyOptim<float> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
     SimulationNBodyBarnesHutOMP simuTest(n, scheme, soft);
     simuTest.setDt(dt);
+    simuTest.setMortonBuild(morton);
+    simuTest.setRefitTolerance(refitTolerance);
+    simuTest.setQuadrupole(quadrupole);
+    if (dualTree)
+        simuTest.setDualTree(true);
+    simuTest.setReorderPeriod(reorderPeriod);
+    simuTest.setThetaTarget(thetaTarget);
 
     const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
     const float *yRef = simuRef.getBodies().getDataSoA().qy.data();
@@ -25,6 +34,7 @@ void test_nbody_barnes_hut_omp(const size_t n, const float soft, const float dt,
     const float *xTest = simuTest.getBodies().getDataSoA().qx.data();
     const float *yTest = simuTest.getBodies().getDataSoA().qy.data();
     const float *zTest = simuTest.getBodies().getDataSoA().qz.data();
+    const std::vector<unsigned long> &ids = simuTest.getBodies().getIds(); // the reordered bodies keep their id
 
     float e = 0; // espilon
     for (size_t i = 0; i < nIte + 1; i++) {
@@ -35,9 +45,9 @@ void test_nbody_barnes_hut_omp(const size_t n, const float soft, const float dt,
         }
 
         for (size_t b = 0; b < simuRef.getBodies().getN(); b++) {
-            REQUIRE_THAT(xRef[b], Catch::Matchers::WithinRel(xTest[b], e));
-            REQUIRE_THAT(yRef[b], Catch::Matchers::WithinRel(yTest[b], e));
-            REQUIRE_THAT(zRef[b], Catch::Matchers::WithinRel(zTest[b], e));
+            REQUIRE_THAT(xRef[ids[b]], Catch::Matchers::WithinRel(xTest[b], e));
+            REQUIRE_THAT(yRef[ids[b]], Catch::Matchers::WithinRel(yTest[b], e));
+            REQUIRE_THAT(zRef[ids[b]], Catch::Matchers::WithinRel(zTest[b], e));
         }
     }
 }
@@ -58,3 +68,52 @@ TEST_CASE("n-body - BarnesHutOmp", "[barnes_hut_omp]")
     SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_barnes_hut_omp(2048, 2e+08, 3600, 4, "galaxy", 1e-1); }
     SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
 }
+
+TEST_CASE("n-body - BarnesHutOmp (Morton build)", "[barnes_hut_omp_morton]")
+{
+    SECTION("fp32 - n=13 - i=1 - random") { test_nbody_barnes_hut_omp(13, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_barnes_hut_omp(13, 2e+08, 3600, 100, "random", 5e-3, true); }
+    SECTION("fp32 - n=16 - i=1 - random") { test_nbody_barnes_hut_omp(16, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=128 - i=1 - random") { test_nbody_barnes_hut_omp(128, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=2048 - i=1 - random") { test_nbody_barnes_hut_omp(2048, 2e+08, 3600, 1, "random", 1e-3, true); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "random", 1e-3, true); }
+
+    SECTION("fp32 - n=13 - i=1 - galaxy") { test_nbody_barnes_hut_omp(13, 2e+08, 3600, 1, "galaxy", 1e-1, true); }
+    SECTION("fp32 - n=13 - i=30 - galaxy") { test_nbody_barnes_hut_omp(13, 2e+08, 3600, 30, "galaxy", 1e-1, true); }
+    SECTION("fp32 - n=16 - i=1 - galaxy") { test_nbody_barnes_hut_omp(16, 2e+08, 3600, 1, "galaxy", 1e-2, true); }
+    SECTION("fp32 - n=128 - i=1 - galaxy") { test_nbody_barnes_hut_omp(128, 2e+08, 3600, 1, "galaxy", 1e-2, true); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_barnes_hut_omp(2048, 2e+08, 3600, 4, "galaxy", 1e-1, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true); }
+}
+
+TEST_CASE("n-body - BarnesHutOmp (refit)", "[barnes_hut_omp_refit]")
+{
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "random", 1e-3, false, 0.1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 0.1); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy - no rebuild") { test_nbody_barnes_hut_omp(2048, 2e+08, 3600, 4, "galaxy", 1e-1, false, 100); }
+}
+
+TEST_CASE("n-body - BarnesHutOmp (quadrupole)", "[barnes_hut_omp_quadrupole]")
+{
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "random", 1e-3, false, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - Morton") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true, 0, true); }
+}
+
+TEST_CASE("n-body - BarnesHutOmp (dual tree)", "[barnes_hut_omp_dual_tree]")
+{
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_barnes_hut_omp(13, 2e+08, 3600, 100, "random", 5e-3, false, 0, false, true); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "random", 1e-3, false, 0, false, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 0, false, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - Morton") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true, 0, false, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - tuned") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, false, 0, false, true, 0, 1e-3); }
+}
+
+TEST_CASE("n-body - BarnesHutOmp (reordered bodies)", "[barnes_hut_omp_reorder]")
+{
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_barnes_hut_omp(13, 2e+08, 3600, 100, "random", 5e-3, false, 0, false, false, 1); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "random", 1e-3, false, 0, false, false, 1); }
+    SECTION("fp32 - n=2049 - i=3 - random - refit") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "random", 1e-3, false, 0.1, false, false, 2); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_barnes_hut_omp(2048, 2e+08, 3600, 4, "galaxy", 1e-1, false, 0, false, false, 2); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - Morton build") { test_nbody_barnes_hut_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, true, 0, false, false, 1); }
+}
@@ -11,10 +11,10 @@
 void test_nbody_dumb(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
                      const float eps)
 {
-    SimulationNBodyNaive simuRef(n, scheme, soft);
+    SimulationNBodyNaive<float> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
-    SimulationNBodyNaive simuTest(n, scheme, soft);
+    SimulationNBodyNaive<float> simuTest(n, scheme, soft);
     simuTest.setDt(dt);
 
     const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
@@ -12,10 +12,10 @@
 void test_nobdy_omp(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
                      const float eps)
 {
-    SimulationNBodyOptim simuRef(n, scheme, soft);
+    SimulationNBodyOptim<float> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
-    SimulationNBodyOMP simuTest(n, scheme, soft);
+    SimulationNBodyOMP<float> simuTest(n, scheme, soft);
     simuTest.setDt(dt);
 
     const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
@@ -58,3 +58,14 @@ TEST_CASE("n-body - OMP", "[omp]")
     SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nobdy_omp(2048, 2e+08, 3600, 4, "galaxy", 1e-1); }
     SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nobdy_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
 }
+
+TEST_CASE("n-body - OMP - threads", "[omp_threads]")
+{
+    // several threads even on a single core, so that the pairs of a row are spread over several buffers
+    const int nThreads = omp_get_max_threads();
+    omp_set_num_threads(3);
+    SECTION("fp32 - n=13 - i=100 - random") { test_nobdy_omp(13, 2e+08, 3600, 100, "random", 5e-3); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nobdy_omp(2049, 2e+08, 3600, 3, "random", 1e-3); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nobdy_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
+    omp_set_num_threads(nThreads);
+}
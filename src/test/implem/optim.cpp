@@ -12,10 +12,10 @@
 void test_nbody_optim(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
                      const float eps)
 {
-    SimulationNBodyNaive simuRef(n, scheme, soft);
+    SimulationNBodyNaive<float> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
-    SimulationNBodyOptim simuTest(n, scheme, soft);
+    SimulationNBodyOptim<float> simuTest(n, scheme, soft);
     simuTest.setDt(dt);
 
     const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
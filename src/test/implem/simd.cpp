@@ -7,26 +7,30 @@
 #include <string>
 
 #include "SimulationNBodyOptim.hpp"
+#include "SimulationNBodyProbe.hpp"
 #include "SimulationNBodySIMD.hpp"
 
+template <typename T = float>
 void test_nbody_simd(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
-                     const float eps)
+                     const float eps, const unsigned rsqrtIterations = 0, const bool compensated = false)
 {
-    SimulationNBodyOptim simuRef(n, scheme, soft);
+    SimulationNBodyOptim<T> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
-    SimulationNBodySIMD simuTest(n, scheme, soft);
+    SimulationNBodySIMD<T> simuTest(n, scheme, soft);
     simuTest.setDt(dt);
+    simuTest.setRsqrtIterations(rsqrtIterations);
+    simuTest.setCompensated(compensated);
 
-    const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
-    const float *yRef = simuRef.getBodies().getDataSoA().qy.data();
-    const float *zRef = simuRef.getBodies().getDataSoA().qz.data();
+    const T *xRef = simuRef.getBodies().getDataSoA().qx.data();
+    const T *yRef = simuRef.getBodies().getDataSoA().qy.data();
+    const T *zRef = simuRef.getBodies().getDataSoA().qz.data();
 
-    const float *xTest = simuTest.getBodies().getDataSoA().qx.data();
-    const float *yTest = simuTest.getBodies().getDataSoA().qy.data();
-    const float *zTest = simuTest.getBodies().getDataSoA().qz.data();
+    const T *xTest = simuTest.getBodies().getDataSoA().qx.data();
+    const T *yTest = simuTest.getBodies().getDataSoA().qy.data();
+    const T *zTest = simuTest.getBodies().getDataSoA().qz.data();
 
-    float e = 0; // espilon
+    T e = 0; // espilon
     for (size_t i = 0; i < nIte + 1; i++) {
         if (i > 0) {
             simuRef.computeOneIteration();
@@ -42,6 +46,25 @@ void test_nbody_simd(const size_t n, const float soft, const float dt, const siz
     }
 }
 
+// The fp32 bodies are generated in fp32 from the same seed, which alone gives an error of about 1e-7 (random) and
+// 2e-7 (galaxy) against the fp64 ones: `eps` is just above that floor, and the compensated error has to be well under
+// the plain one.
+void test_nbody_simd_kahan_accuracy(const size_t n, const float soft, const std::string &scheme, const double eps)
+{
+    SimulationNBodyProbe<SimulationNBodyOptim<double>> simuRef(n, scheme, soft);
+    simuRef.computeAccelerations();
+
+    SimulationNBodyProbe<SimulationNBodySIMD<float>> simuTest(n, scheme, soft);
+    simuTest.computeAccelerations();
+    const double plain = rmsAccelerationError(simuTest, simuRef);
+    simuTest.setCompensated(true);
+    simuTest.computeAccelerations();
+    const double compensated = rmsAccelerationError(simuTest, simuRef);
+
+    REQUIRE(compensated < eps);
+    REQUIRE(compensated < plain / 4);
+}
+
 TEST_CASE("n-body - SIMD", "[simd]")
 {
     SECTION("fp32 - n=13 - i=1 - random") { test_nbody_simd(13, 2e+08, 3600, 1, "random", 1e-3); }
@@ -49,6 +72,7 @@ TEST_CASE("n-body - SIMD", "[simd]")
     SECTION("fp32 - n=16 - i=1 - random") { test_nbody_simd(16, 2e+08, 3600, 1, "random", 1e-3); }
     SECTION("fp32 - n=128 - i=1 - random") { test_nbody_simd(128, 2e+08, 3600, 1, "random", 1e-3); }
     SECTION("fp32 - n=2048 - i=1 - random") { test_nbody_simd(2048, 2e+08, 3600, 1, "random", 1e-3); }
+    SECTION("fp32 - n=1000 - i=2 - random") { test_nbody_simd(1000, 2e+08, 3600, 2, "random", 1e-3); }
     SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_simd(2049, 2e+08, 3600, 3, "random", 1e-3); }
 
     SECTION("fp32 - n=13 - i=1 - galaxy") { test_nbody_simd(13, 2e+08, 3600, 1, "galaxy", 1e-1); }
@@ -58,3 +82,39 @@ TEST_CASE("n-body - SIMD", "[simd]")
     SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_simd(2048, 2e+08, 3600, 4, "galaxy", 1e-1); }
     SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_simd(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
 }
+
+TEST_CASE("n-body - SIMD - rsqrt", "[simd_rsqrt]")
+{
+    SECTION("fp32 - n=13 - i=100 - random - nr=1") { test_nbody_simd(13, 2e+08, 3600, 100, "random", 5e-3, 1); }
+    SECTION("fp32 - n=2049 - i=3 - random - nr=1") { test_nbody_simd(2049, 2e+08, 3600, 3, "random", 1e-3, 1); }
+    SECTION("fp32 - n=2049 - i=3 - random - nr=2") { test_nbody_simd(2049, 2e+08, 3600, 3, "random", 1e-3, 2); }
+
+    SECTION("fp32 - n=13 - i=30 - galaxy - nr=1") { test_nbody_simd(13, 2e+08, 3600, 30, "galaxy", 1e-1, 1); }
+    SECTION("fp32 - n=128 - i=1 - galaxy - nr=1") { test_nbody_simd(128, 2e+08, 3600, 1, "galaxy", 1e-2, 1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - nr=1") { test_nbody_simd(2049, 2e+08, 3600, 3, "galaxy", 1e-1, 1); }
+}
+
+TEST_CASE("n-body - SIMD - kahan", "[simd_kahan]")
+{
+    SECTION("fp32 - n=13 - i=100 - random") { test_nbody_simd(13, 2e+08, 3600, 100, "random", 5e-3, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_simd(2049, 2e+08, 3600, 3, "random", 1e-3, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - random - nr=1") { test_nbody_simd(2049, 2e+08, 3600, 3, "random", 1e-3, 1, true); }
+
+    SECTION("fp32 - n=128 - i=1 - galaxy") { test_nbody_simd(128, 2e+08, 3600, 1, "galaxy", 1e-2, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_simd(2049, 2e+08, 3600, 3, "galaxy", 1e-1, 0, true); }
+
+    SECTION("fp32 vs fp64 - n=8192 - random") { test_nbody_simd_kahan_accuracy(8192, 2e+08, "random", 1.5e-7); }
+    SECTION("fp32 vs fp64 - n=8192 - galaxy") { test_nbody_simd_kahan_accuracy(8192, 2e+08, "galaxy", 3e-7); }
+}
+
+TEST_CASE("n-body - SIMD - fp64", "[simd_fp64]")
+{
+    SECTION("fp64 - n=13 - i=100 - random") { test_nbody_simd<double>(13, 2e+08, 3600, 100, "random", 1e-9); }
+    SECTION("fp64 - n=2049 - i=3 - random") { test_nbody_simd<double>(2049, 2e+08, 3600, 3, "random", 1e-9); }
+    SECTION("fp64 - n=2049 - i=3 - random - nr=2") { test_nbody_simd<double>(2049, 2e+08, 3600, 3, "random", 1e-9, 2); }
+    SECTION("fp64 - n=2049 - i=3 - random - kahan") { test_nbody_simd<double>(2049, 2e+08, 3600, 3, "random", 1e-9, 0, true); }
+
+    SECTION("fp64 - n=13 - i=30 - galaxy") { test_nbody_simd<double>(13, 2e+08, 3600, 30, "galaxy", 1e-6); }
+    SECTION("fp64 - n=2049 - i=3 - galaxy") { test_nbody_simd<double>(2049, 2e+08, 3600, 3, "galaxy", 1e-6); }
+}
+
@@ -7,26 +7,30 @@
 #include <string>
 
 #include "SimulationNBodyOptim.hpp"
+#include "SimulationNBodyProbe.hpp"
 #include "SimulationNBodySIMD_OMP.hpp"
 
+template <typename T = float>
 void test_nbody_simd_omp(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
-                     const float eps)
+                     const float eps, const unsigned rsqrtIterations = 0, const bool compensated = false)
 {
-    SimulationNBodyOptim simuRef(n, scheme, soft);
+    SimulationNBodyOptim<T> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
-    SimulationNBodySIMD_OMP simuTest(n, scheme, soft);
+    SimulationNBodySIMD_OMP<T> simuTest(n, scheme, soft);
     simuTest.setDt(dt);
+    simuTest.setRsqrtIterations(rsqrtIterations);
+    simuTest.setCompensated(compensated);
 
-    const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
-    const float *yRef = simuRef.getBodies().getDataSoA().qy.data();
-    const float *zRef = simuRef.getBodies().getDataSoA().qz.data();
+    const T *xRef = simuRef.getBodies().getDataSoA().qx.data();
+    const T *yRef = simuRef.getBodies().getDataSoA().qy.data();
+    const T *zRef = simuRef.getBodies().getDataSoA().qz.data();
 
-    const float *xTest = simuTest.getBodies().getDataSoA().qx.data();
-    const float *yTest = simuTest.getBodies().getDataSoA().qy.data();
-    const float *zTest = simuTest.getBodies().getDataSoA().qz.data();
+    const T *xTest = simuTest.getBodies().getDataSoA().qx.data();
+    const T *yTest = simuTest.getBodies().getDataSoA().qy.data();
+    const T *zTest = simuTest.getBodies().getDataSoA().qz.data();
 
-    float e = 0; // espilon
+    T e = 0; // espilon
     for (size_t i = 0; i < nIte + 1; i++) {
         if (i > 0) {
             simuRef.computeOneIteration();
@@ -42,6 +46,23 @@ void test_nbody_simd_omp(const size_t n, const float soft, const float dt, const
     }
 }
 
+// see `test_nbody_simd_kahan_accuracy`
+void test_nbody_simd_omp_kahan_accuracy(const size_t n, const float soft, const std::string &scheme, const double eps)
+{
+    SimulationNBodyProbe<SimulationNBodyOptim<double>> simuRef(n, scheme, soft);
+    simuRef.computeAccelerations();
+
+    SimulationNBodyProbe<SimulationNBodySIMD_OMP<float>> simuTest(n, scheme, soft);
+    simuTest.computeAccelerations();
+    const double plain = rmsAccelerationError(simuTest, simuRef);
+    simuTest.setCompensated(true);
+    simuTest.computeAccelerations();
+    const double compensated = rmsAccelerationError(simuTest, simuRef);
+
+    REQUIRE(compensated < eps);
+    REQUIRE(compensated < plain / 4);
+}
+
 TEST_CASE("n-body - SIMD_OMP", "[simd_omp]")
 {
     SECTION("fp32 - n=13 - i=1 - random") { test_nbody_simd_omp(13, 2e+08, 3600, 1, "random", 1e-3); }
@@ -58,3 +79,29 @@ TEST_CASE("n-body - SIMD_OMP", "[simd_omp]")
     SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_simd_omp(2048, 2e+08, 3600, 4, "galaxy", 1e-1); }
     SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_simd_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
 }
+
+TEST_CASE("n-body - SIMD_OMP - rsqrt", "[simd_omp_rsqrt]")
+{
+    SECTION("fp32 - n=2049 - i=3 - random - nr=1") { test_nbody_simd_omp(2049, 2e+08, 3600, 3, "random", 1e-3, 1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - nr=1") { test_nbody_simd_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, 1); }
+}
+
+TEST_CASE("n-body - SIMD_OMP - kahan", "[simd_omp_kahan]")
+{
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_simd_omp(2049, 2e+08, 3600, 3, "random", 1e-3, 0, true); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_simd_omp(2049, 2e+08, 3600, 3, "galaxy", 1e-1, 0, true); }
+
+    SECTION("fp32 vs fp64 - n=8192 - random") { test_nbody_simd_omp_kahan_accuracy(8192, 2e+08, "random", 1.5e-7); }
+    SECTION("fp32 vs fp64 - n=8192 - galaxy") { test_nbody_simd_omp_kahan_accuracy(8192, 2e+08, "galaxy", 3e-7); }
+}
+
+TEST_CASE("n-body - SIMD_OMP - fp64", "[simd_omp_fp64]")
+{
+    SECTION("fp64 - n=13 - i=100 - random") { test_nbody_simd_omp<double>(13, 2e+08, 3600, 100, "random", 1e-9); }
+    SECTION("fp64 - n=2049 - i=3 - random") { test_nbody_simd_omp<double>(2049, 2e+08, 3600, 3, "random", 1e-9); }
+    SECTION("fp64 - n=2049 - i=3 - random - nr=2") { test_nbody_simd_omp<double>(2049, 2e+08, 3600, 3, "random", 1e-9, 2); }
+    SECTION("fp64 - n=2049 - i=3 - random - kahan") { test_nbody_simd_omp<double>(2049, 2e+08, 3600, 3, "random", 1e-9, 0, true); }
+
+    SECTION("fp64 - n=13 - i=30 - galaxy") { test_nbody_simd_omp<double>(13, 2e+08, 3600, 30, "galaxy", 1e-6); }
+    SECTION("fp64 - n=2049 - i=3 - galaxy") { test_nbody_simd_omp<double>(2049, 2e+08, 3600, 3, "galaxy", 1e-6); }
+}
@@ -9,24 +9,27 @@
 #include "SimulationNBodyOptim.hpp"
 #include "SimulationNBodySIMDPThread.hpp"
 
+template <typename T = float>
 void test_nbody_simd_pthread(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
-                     const float eps)
+                     const float eps, const unsigned nThreads = 0)
 {
-    SimulationNBodyOptim simuRef(n, scheme, soft);
+    SimulationNBodyOptim<T> simuRef(n, scheme, soft);
     simuRef.setDt(dt);
 
-    SimulationNBodySIMDPThread simuTest(n, scheme, soft);
+    SimulationNBodySIMDPThread<T> simuTest(n, scheme, soft);
     simuTest.setDt(dt);
+    if (nThreads)
+        simuTest.setThreads(nThreads);
 
-    const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
-    const float *yRef = simuRef.getBodies().getDataSoA().qy.data();
-    const float *zRef = simuRef.getBodies().getDataSoA().qz.data();
+    const T *xRef = simuRef.getBodies().getDataSoA().qx.data();
+    const T *yRef = simuRef.getBodies().getDataSoA().qy.data();
+    const T *zRef = simuRef.getBodies().getDataSoA().qz.data();
 
-    const float *xTest = simuTest.getBodies().getDataSoA().qx.data();
-    const float *yTest = simuTest.getBodies().getDataSoA().qy.data();
-    const float *zTest = simuTest.getBodies().getDataSoA().qz.data();
+    const T *xTest = simuTest.getBodies().getDataSoA().qx.data();
+    const T *yTest = simuTest.getBodies().getDataSoA().qy.data();
+    const T *zTest = simuTest.getBodies().getDataSoA().qz.data();
 
-    float e = 0; // espilon
+    T e = 0; // espilon
     for (size_t i = 0; i < nIte + 1; i++) {
         if (i > 0) {
             simuRef.computeOneIteration();
@@ -58,3 +61,21 @@ TEST_CASE("n-body - SIMD_PTHREAD", "[simd_pthread]")
     SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_simd_pthread(2048, 2e+08, 3600, 4, "galaxy", 1e-1); }
     SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_simd_pthread(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
 }
+
+TEST_CASE("n-body - SIMD_PTHREAD - threads", "[simd_pthread_threads]")
+{
+    SECTION("fp32 - n=13 - i=100 - random - t=1") { test_nbody_simd_pthread(13, 2e+08, 3600, 100, "random", 5e-3, 1); }
+    SECTION("fp32 - n=13 - i=100 - random - t=4") { test_nbody_simd_pthread(13, 2e+08, 3600, 100, "random", 5e-3, 4); }
+    SECTION("fp32 - n=2049 - i=3 - random - t=3") { test_nbody_simd_pthread(2049, 2e+08, 3600, 3, "random", 1e-3, 3); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - t=3") { test_nbody_simd_pthread(2049, 2e+08, 3600, 3, "galaxy", 1e-1, 3); }
+}
+
+TEST_CASE("n-body - SIMD_PTHREAD - fp64", "[simd_pthread_fp64]")
+{
+    SECTION("fp64 - n=13 - i=100 - random") { test_nbody_simd_pthread<double>(13, 2e+08, 3600, 100, "random", 1e-9); }
+    SECTION("fp64 - n=2049 - i=3 - random") { test_nbody_simd_pthread<double>(2049, 2e+08, 3600, 3, "random", 1e-9); }
+    SECTION("fp64 - n=2049 - i=3 - random - t=3") { test_nbody_simd_pthread<double>(2049, 2e+08, 3600, 3, "random", 1e-9, 3); }
+
+    SECTION("fp64 - n=13 - i=30 - galaxy") { test_nbody_simd_pthread<double>(13, 2e+08, 3600, 30, "galaxy", 1e-6); }
+    SECTION("fp64 - n=2049 - i=3 - galaxy") { test_nbody_simd_pthread<double>(2049, 2e+08, 3600, 3, "galaxy", 1e-6); }
+}
@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <catch.hpp>
+#include <cmath>
+#include <exception>
+#include <numeric>
+#include <random>
+#include <string>
+
+#include "SimulationNBodyOptim.hpp"
+#include "SimulationNBodyTreePM.hpp"
+
+void test_nbody_treepm(const size_t n, const float soft, const float dt, const size_t nIte, const std::string &scheme,
+                   const float eps, const unsigned gridSize = PM_GRID_SIZE)
+{
+    SimulationNBodyOptim<float> simuRef(n, scheme, soft);
+    simuRef.setDt(dt);
+
+    SimulationNBodyTreePM simuTest(n, scheme, soft);
+    simuTest.setDt(dt);
+    simuTest.setGridSize(gridSize);
+
+    const float *xRef = simuRef.getBodies().getDataSoA().qx.data();
+    const float *yRef = simuRef.getBodies().getDataSoA().qy.data();
+    const float *zRef = simuRef.getBodies().getDataSoA().qz.data();
+
+    const float *xTest = simuTest.getBodies().getDataSoA().qx.data();
+    const float *yTest = simuTest.getBodies().getDataSoA().qy.data();
+    const float *zTest = simuTest.getBodies().getDataSoA().qz.data();
+
+    float e = 0; // espilon
+    for (size_t i = 0; i < nIte + 1; i++) {
+        if (i > 0) {
+            simuRef.computeOneIteration();
+            simuTest.computeOneIteration();
+            e = eps;
+        }
+
+        for (size_t b = 0; b < simuRef.getBodies().getN(); b++) {
+            REQUIRE_THAT(xRef[b], Catch::Matchers::WithinRel(xTest[b], e));
+            REQUIRE_THAT(yRef[b], Catch::Matchers::WithinRel(yTest[b], e));
+            REQUIRE_THAT(zRef[b], Catch::Matchers::WithinRel(zTest[b], e));
+        }
+    }
+}
+
+TEST_CASE("n-body - TreePM", "[treepm]")
+{
+    // the long range part is still smoothed at the scale of a cell, the few body systems are the worst case of the
+    // method as with PM
+    SECTION("fp32 - n=13 - i=1 - random") { test_nbody_treepm(13, 2e+08, 3600, 1, "random", 1e-3); }
+    SECTION("fp32 - n=13 - i=100 - random - grid=32") { test_nbody_treepm(13, 2e+08, 3600, 100, "random", 5e-2, 32); }
+    SECTION("fp32 - n=16 - i=1 - random") { test_nbody_treepm(16, 2e+08, 3600, 1, "random", 1e-3); }
+    SECTION("fp32 - n=128 - i=1 - random") { test_nbody_treepm(128, 2e+08, 3600, 1, "random", 1e-3); }
+    SECTION("fp32 - n=2048 - i=1 - random") { test_nbody_treepm(2048, 2e+08, 3600, 1, "random", 1e-3); }
+    SECTION("fp32 - n=2049 - i=3 - random") { test_nbody_treepm(2049, 2e+08, 3600, 3, "random", 1e-3); }
+
+    SECTION("fp32 - n=13 - i=1 - galaxy") { test_nbody_treepm(13, 2e+08, 3600, 1, "galaxy", 1e-1); }
+    SECTION("fp32 - n=16 - i=1 - galaxy") { test_nbody_treepm(16, 2e+08, 3600, 1, "galaxy", 1e-1); }
+    SECTION("fp32 - n=128 - i=1 - galaxy") { test_nbody_treepm(128, 2e+08, 3600, 1, "galaxy", 1e-1); }
+    SECTION("fp32 - n=2048 - i=4 - galaxy") { test_nbody_treepm(2048, 2e+08, 3600, 4, "galaxy", 1e-1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy") { test_nbody_treepm(2049, 2e+08, 3600, 3, "galaxy", 1e-1); }
+    SECTION("fp32 - n=2049 - i=3 - galaxy - grid=32") { test_nbody_treepm(2049, 2e+08, 3600, 3, "galaxy", 1e-1, 32); }
+    SECTION("quadrupole refused") {
+        SimulationNBodyTreePM simu(13, "random", 2e+08);
+        REQUIRE_FALSE(simu.setQuadrupole(true));
+        REQUIRE(simu.getTheta() == THETA);
+        REQUIRE(simu.setQuadrupole(false));
+    }
+}